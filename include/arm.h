@@ -98,6 +98,56 @@ static inline void outw(u_int32 addr, u_int32 data)
 }
 
 
+u_int32 div(u_int32 n, u_int32 d);
+
+/**
+ * Divides unsigned integers.
+ *
+ * udiv ("Unsigned Divide") computes 'n' / 'd' where 'd' may not
+ * be known at compile time. C code should use it in place of '/'.
+ *
+ * The Cortex-A7 (hw=rpi2) has a UDIV instruction, which '/' compiles
+ * to. The ARM1176 (rpi1) and Cortex-A9 (fvp) have none, and the kernel
+ * is not linked with libgcc's division helpers. On those cores, a
+ * constant divisor is left to the compiler, which shifts or multiplies,
+ * a power of two divisor is a shift, and other divisors call div().
+ *
+ * @param n - The numerator to divide.
+ * @param d - The denominator to divide by. It must not be zero.
+ * @return The integer quotient of 'n' and 'd'.
+ * @see div() in div.c.
+ */
+static inline u_int32 udiv(u_int32 n, u_int32 d)
+{
+#if defined (RPI2)
+    return n / d;
+#else
+    if (__builtin_constant_p(d)) {
+        return n / d;
+    }
+    if ((d & (d - 1)) == 0) {
+        return n >> __builtin_ctz(d);
+    }
+    return div(n, d);
+#endif
+}
+
+
+/**
+ * Computes the remainder of unsigned integer division.
+ *
+ * umod ("Unsigned Modulo") computes 'n' % 'd', by udiv().
+ *
+ * @param n - The numerator to divide.
+ * @param d - The denominator to divide by. It must not be zero.
+ * @return The remainder of 'n' divided by 'd'.
+ */
+static inline u_int32 umod(u_int32 n, u_int32 d)
+{
+    return n - udiv(n, d) * d;
+}
+
+
 /**
  * @struct trapframe - The layout of a trap frame on the stack.
  *
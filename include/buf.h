@@ -2,12 +2,16 @@ struct buf {
   int flags;
   u_int32 dev;
   u_int32 sector;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket's MRU list
   struct buf *next;
+  struct buf *cnext; // clock ring of all buffers
+  u_char8 ref;         // used since the clock hand last passed
   struct buf *qnext; // disk queue
-  u_char8 data[512];
+  u_char8 *data;     // BSIZE bytes
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read ahead: the driver releases the buffer when done
+#define B_ERROR 0x10 // the driver gave up on the last transfer
 
@@ -4,6 +4,7 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rastate;
 struct spinlock;
 struct stat;
 struct superblock;
@@ -14,6 +15,7 @@ void not_ok_loop(void);
 // mmu.c
 void mmu_init_stage1(void);
 void mmu_init_stage2(void);
+void mmu_gpumem_wc(u_int32 va, u_int32 n);
 void barriers(void);
 void dsb_barrier(void);
 void flush_tlb(void);
@@ -21,10 +23,26 @@ void flush_dcache_all(void);
 void flush_dcache(u_int32 va1, u_int32 va2);
 void flush_idcache(void);
 void set_pgtbase(u_int32 base);
+void set_ttbr1(u_int32 base);
+void set_ttbcr(u_int32 ttbcr);
+void set_ttbr0_asid(u_int32 base, u_int32 asid);
+void flush_tlb_asid(u_int32 asid);
+void flush_tlb_page(u_int32 va, u_int32 asid);
+u_int32 get_dfar(void);
+u_int32 get_dfsr(void);
+void spin_lock(volatile u_int32 *locked);
+void spin_unlock(volatile u_int32 *locked);
+void send_event(void);
+void wait_event(void);
+u_int32 get_cntfrq(void);
+void set_cntp_tval(u_int32 tval);
+void set_cntp_ctl(u_int32 ctl);
 
 // bio.c
 void            binit(void);
+int             bcachestat(char*, int);
 struct buf*     bread(u_int32, u_int32);
+void            breadahead(u_int32, u_int32);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -35,18 +53,35 @@ void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 void		drawcharacter(u_char8, u_int32, u_int32);
 void		gpuputc(u_int32);
+void		gpuputs(char*, int);
 void		gpuinit(void);
 
+// div.c
+u_int32         div(u_int32 n, u_int32 d);
+
+// dma.c
+void            dmainit(void);
+void            dmaintr(void);
+int             dmacopy(void*, void*, u_int32);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+int             dcachestat(char*, int);
+void            dcunlink(struct inode*, char*);
 int             dirlink(struct inode*, char*, u_int32);
+void            fsinit(int);
 struct inode*   dirlookup(struct inode*, char*, u_int32*);
 struct inode*   ialloc(u_int32, short);
+void            ireadahead(struct inode*, struct rastate*, u_int32, u_int32);
+int             icachestat(char*, int);
+int             idenywrite(struct inode*);
 struct inode*   idup(struct inode*);
+void            iallowwrite(struct inode*);
+int             igetwrite(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            iputwrite(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -78,13 +113,22 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+int             dcachestat(char*, int);
+void            dcunlink(struct inode*, char*);
 int             dirlink(struct inode*, char*, u_int32);
+void            fsinit(int);
 struct inode*   dirlookup(struct inode*, char*, u_int32*);
 struct inode*   ialloc(u_int32, short);
+void            ireadahead(struct inode*, struct rastate*, u_int32, u_int32);
+int             icachestat(char*, int);
+int             idenywrite(struct inode*);
 struct inode*   idup(struct inode*);
+void            iallowwrite(struct inode*);
+int             igetwrite(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            iputwrite(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -98,8 +142,14 @@ int             writei(struct inode*, char*, u_int32, u_int32);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kdup(char*);
+int             krefcnt(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kzalloc(void);
+int             kzeroidle(void);
+int             kfreepages(void);
+int             kallocstat(char*, int);
 
 
 // log.c
@@ -107,6 +157,8 @@ void            initlog(void);
 void            log_write(struct buf*);
 void            begin_trans();
 void            commit_trans();
+int             begin_ntrans(int);
+void            commit_ntrans(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -125,10 +177,12 @@ void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             setpriority(int);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 
 
@@ -138,6 +192,7 @@ void            swtch(struct context**, struct context*);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(u_int32, int*);
 int             fetchstr(u_int32, char**);
@@ -170,11 +225,11 @@ char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, u_int32);
 char*           strncpy(char*, const char*, int);
-u_int32 		div(u_int32 n, u_int32 d);
 
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(u_int32, int*);
 int             fetchstr(u_int32, char**);
@@ -183,6 +238,12 @@ void            syscall(void);
 // timer.c
 void		timer3init(void);
 void		timer3intr(void);
+int		timerwait(unsigned long long);
+u_int32		timerticks(void);
+void		tickstart(void);
+void		tickintr(void);
+void		localtimerinit(void);
+void		localtimerintr(void);
 unsigned long long getsystemtime(void);
 void		delay(u_int32);
 
@@ -192,15 +253,16 @@ void		sti(void);
 void		cli(void);
 void 		disable_intrs(void);
 void 		enable_intrs(void);
-extern u_int32     ticks;
-extern struct spinlock ticks_lock;
 u_int32		readcpsr(void);
 void init_mode_stack(u_int32 mode);
+void init_mode_stacks(void);
 
 // uart.c
 void        uartinit(void);
 void        miniuartintr(void);
 void        uartputc(u_int32);
+void        uartputs(char*, int);
+void        uartflush(void);
 void		setgpiofunc(u_int32, u_int32);
 void		setgpioval(u_int32, u_int32);
 
@@ -214,10 +276,16 @@ int             allocuvm(pde_t*, u_int32, u_int32);
 int             deallocuvm(pde_t*, u_int32, u_int32);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, u_int32);
-int             loaduvm(pde_t*, char*, struct inode*, u_int32, u_int32);
 pde_t*          copyuvm(pde_t*, u_int32);
+int             cowfault(struct proc*, u_int32);
+int             pagefault(struct proc*, u_int32);
+int             prefaultuvm(struct proc*, u_int32, u_int32, int);
+int             pageflip(struct proc*, u_int32, char**);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            asidinit(void);
+void            kvmcpuinit(void);
+void            flushuvm(struct proc*);
 int             copyout(pde_t*, u_int32, void*, u_int32);
 void            clearpteu(pde_t *pgdir, char *uva);
 
@@ -229,6 +297,9 @@ void mailboxinit(void);
 
 
 
+// mp.c
+void            mpstart(void);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
 
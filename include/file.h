@@ -1,3 +1,10 @@
+// Sequential read detection and readahead, for ireadahead().
+struct rastate {
+  u_int32 next;  // offset at which a sequential read would start
+  u_int32 win;   // readahead window in blocks, 0 if not sequential
+  u_int32 end;   // offset up to which blocks have been read ahead
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
   int ref; // reference count
@@ -6,6 +13,7 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   u_int32 off;
+  struct rastate ra;
 };
 
 
@@ -15,13 +23,19 @@ struct inode {
   u_int32 inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  int nexec;          // processes running it as p->exe
+  int nwrite;         // open files that may write it
+  u_int32 bhint;      // next block balloc() should try for it
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // icache LRU list, while ref is 0
+  struct inode *next;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   u_int32 size;
-  u_int32 addrs[NDIRECT+1];
+  u_int32 addrs[NDIRECT+2];
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
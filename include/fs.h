@@ -9,7 +9,12 @@
 // Then sb.nlog log blocks.
 
 #define ROOTINO 1  // root i-number
+// The block size is fixed when the kernel and mkfs are built,
+// by make bsize=1024 (or 2048, 4096), and mkfs records it in
+// the superblock.
+#ifndef BSIZE
 #define BSIZE 512  // block size
+#endif
 
 // File system super block
 struct superblock {
@@ -17,11 +22,13 @@ struct superblock {
   u_int32 nblocks;      // Number of data blocks
   u_int32 ninodes;      // Number of inodes.
   u_int32 nlog;         // Number of log blocks
+  u_int32 bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(u_int32))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -30,7 +37,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   u_int32 size;            // Size of file (bytes)
-  u_int32 addrs[NDIRECT+1];   // Data block addresses
+  u_int32 addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
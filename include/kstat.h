@@ -0,0 +1,39 @@
+// Kernel statistics exported through the kstat system call.
+
+#define KSTAT_KALLOC 1  // struct kallocstat[NCPU]
+#define KSTAT_BCACHE 2  // struct bcachestat
+#define KSTAT_DCACHE 3  // struct dcachestat
+#define KSTAT_ICACHE 4  // struct icachestat
+
+// Per-CPU page allocator counters.
+struct kallocstat {
+  u_int32 hits;    // kalloc() served from the CPU's page cache
+  u_int32 misses;  // kalloc() that refilled from the global freelist
+  u_int32 zeroed;  // kzalloc() served from pages zeroed while idle
+  u_int32 cached;  // pages currently held by the CPU
+};
+
+// Buffer cache counters.
+struct bcachestat {
+  u_int32 nbuf;    // buffers in the cache
+  u_int32 hits;    // bget() found the block cached
+  u_int32 misses;  // bget() had to find a buffer for the block
+  u_int32 evicts;  // misses that recycled a buffer holding another block
+  u_int32 aheads;  // blocks read ahead by breadahead()
+};
+
+// Directory entry cache counters.
+struct dcachestat {
+  u_int32 nent;    // entries in the cache
+  u_int32 hits;    // dirlookup() found the name cached
+  u_int32 neghits; // dirlookup() found the name cached as absent
+  u_int32 misses;  // dirlookup() had to scan the directory
+};
+
+// Inode cache counters.
+struct icachestat {
+  u_int32 ninode;  // entries in the cache
+  u_int32 hits;    // iget() found the inode cached
+  u_int32 misses;  // iget() had to find an entry for the inode
+  u_int32 evicts;  // misses that recycled an entry holding another inode
+};
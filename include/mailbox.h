@@ -1,5 +1,10 @@
 #define MAILBOX_BASE	(MMIO_VA+0x00B880)
 
+/* BCM2836 per-core mailbox 3: the firmware parks secondary cores
+ * until an entry address is written to their mailbox */
+#define CORE_MBOX3_SET(n)	(LOCAL_VA+0x8C+0x10*(n))
+#define CORE_MBOX3_CLR(n)	(LOCAL_VA+0xCC+0x10*(n))
+
 #define MPI_REQUEST 		0x00000000
 #define MPI_RESPONSE_OK		0x80000000
 #define MPI_RESPONSE_ERR	0x80000001
@@ -34,5 +39,7 @@
 #define MPI_TAG_GET_FIRMWARE		0x00000001
 #define MPI_TAG_GET_CLOCK_STATE		0x00030001
 #define MPI_TAG_SET_CLOCK_STATE		0x00038001
+#define MPI_TAG_GET_CLOCK_RATE		0x00030002
+#define MPI_TAG_SET_VIRTUAL_OFFSET	0x00048009
 
 
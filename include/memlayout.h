@@ -17,6 +17,11 @@
 
 #define TVSIZE          0x1000
 
+// BCM2836 per-core timers, interrupts and mailboxes (RPi 2 only)
+#define LOCAL_PA        0x40000000
+#define LOCAL_VA        (MMIO_VA+MMIO_SIZE)
+#define LOCAL_SIZE      MBYTE
+
 static inline u_int32 v2p(void *a) { return ((u_int32) (a))  - (KERNBASE-PHYSTART); }
 static inline void *p2v(u_int32 a) { return (void *) ((a) + (KERNBASE-PHYSTART)); }
 
@@ -222,6 +222,54 @@
 #define PTX_ATRB_CACHED 0x8
 
 
+/**
+ * @def PDX_ATRB_TEX_NORMAL - Indicates a section is normal memory.
+ *
+ * PDX_ATRB_TEX_NORMAL (PDX Attribute: TEX Normal) sets the
+ * TEX field of a section entry to 001. Without PTX_ATRB_CACHED
+ * and PTX_ATRB_BUFFERED, the section is then normal memory which
+ * is not cached, rather than strongly-ordered memory, so writes
+ * to it can be merged in the write buffer ("write-combining").
+ *
+ * @note Normal memory may be read speculatively, so it is
+ * unsuitable for memory-mapped I/O devices.
+ */
+#define PDX_ATRB_TEX_NORMAL (1 << 12)
+
+
+/**
+ * @def PDX_ATRB_SHAREABLE - Indicates a section is shared
+ * between CPU cores.
+ *
+ * PDX_ATRB_SHAREABLE is the section entry equivalent of
+ * PTX_ATRB_SHAREABLE.
+ */
+#define PDX_ATRB_SHAREABLE (1 << 16)
+
+
+/**
+ * @def PDX_ATRB_KMEM - Memory attributes of the sections
+ * which map RAM into the kernel.
+ *
+ * On the Raspberry Pi 2 the D-cache is on, and RAM is
+ * write-back, write-allocate and shareable memory, so the
+ * cores' caches are coherent and LDREX/STREX exclude the
+ * other cores (the BCM2836 has no exclusive monitor for
+ * uncached memory.) Elsewhere the caches stay off.
+ *
+ * @see mp_continue in entry.S, which uses the same
+ * attributes for the boot page directory.
+ */
+#ifdef RPI2
+#define PDX_ATRB_KMEM (PDX_ATRB_TEX_NORMAL \
+                    | PDX_ATRB_SHAREABLE \
+                    | PTX_ATRB_CACHED \
+                    | PTX_ATRB_BUFFERED)
+#else
+#define PDX_ATRB_KMEM (PTX_ATRB_CACHED | PTX_ATRB_BUFFERED)
+#endif
+
+
 /**
  * @def PTX_ATRB_APX - Indicates the memory is read only.
  *
@@ -276,7 +324,9 @@
  * PTX_ATRB_nG can be bitwise OR'ed with other PTX
  * attributes to configure a page's attributes in the MMU.
  *
- * @warning ARM xv6 does not use ARM's ASID features.
+ * ARM xv6 sets nG on every user page, so user TLB
+ * entries survive context switches and are told apart by
+ * the ASID each process is given in switchuvm().
  */
 #define PTX_ATRB_nG (1 << 11)
 
@@ -663,8 +713,7 @@
 #define KVM_PDX_ATRB (PDX_ATRB_DOMAIN0 \
                     | PDX_ATRB_AP(PTX_ATRB_URW) \
                     | PDX_ATRB_SECTION_ENTRY \
-                    | PTX_ATRB_CACHED \
-                    | PTX_ATRB_BUFFERED)
+                    | PDX_ATRB_KMEM)
 
 
 /**
@@ -693,5 +742,77 @@
 #define UVM_PTX_ATRB ((PTX_ATRB_AP(PTX_ATRB_URW) ^ PTX_ATRB_APX) \
                     | PTX_ATRB_CACHED \
                     | PTX_ATRB_BUFFERED  \
+                    | PTX_ATRB_SHAREABLE \
+                    | PTX_ATRB_nG \
                     | PTX_ATRB_SMALL)
 
+
+/**
+ * @def UVM_PTX_COW - Page table attributes for user pages
+ * shared copy-on-write between processes after fork.
+ *
+ * UVM_PTX_COW is UVM_PTX_ATRB made read-only with the APX
+ * bit, so the first write to the page raises a permission
+ * fault, which cowfault() resolves by giving the writer its
+ * own copy. The hardware has no spare software bits in a
+ * small page entry, so these exact attributes mark a COW
+ * page: no other user page is mapped read-only.
+ */
+#define UVM_PTX_COW (UVM_PTX_ATRB | PTX_ATRB_APX)
+
+
+/**
+ * @def TTBR_ATRB - Table walk attributes OR'ed onto the
+ * physical base written to TTBR0 and TTBR1.
+ *
+ * These match the attributes entry.S uses for the boot
+ * page directory (outer write-back, write-allocate walks,
+ * and on the Raspberry Pi 2, shareable.)
+ */
+#ifdef RPI2
+#define TTBR_ATRB 0x4a
+#else
+#define TTBR_ATRB 0x48
+#endif
+
+
+/**
+ * @def TTBCR_N_USER - TTBCR.N value which makes TTBR0
+ * translate only the low USERBOUND (1GB) of the address
+ * space.
+ *
+ * With N = 2, the TTBR0 table has 1024 entries and fits
+ * in the single page allocated by setupkvm(), so a
+ * process' page directory can be installed directly.
+ * Addresses at or above USERBOUND are translated through
+ * TTBR1, which holds kernel_page_dir.
+ */
+#define TTBCR_N_USER 2
+
+
+/**
+ * @def TTBCR_PD0 - TTBCR bit which disables TTBR0 table
+ * walks.
+ *
+ * Set when no process is running on a CPU, so the kernel
+ * cannot stumble into a stale user page directory.
+ */
+#define TTBCR_PD0 (1 << 4)
+
+
+/**
+ * @def ASID_BITS - Width of the ARMv7 Address Space ID
+ * held in CONTEXTIDR.
+ *
+ * ASID 0 is never given to a process. The bits of
+ * proc.context_id above ASID_BITS hold the generation the
+ * ASID was allocated in.
+ *
+ * @see asidget() in vm.c
+ */
+#define ASID_BITS 8
+
+
+/** @def ASID_MASK - Mask for the ASID in proc.context_id. */
+#define ASID_MASK ((1 << ASID_BITS) - 1)
+
@@ -44,7 +44,8 @@ struct cpu {
     volatile u_int32 started;   /**< Indicates if the CPU is started. */
     int ncli;                   /**< depth of pushcli() nesting. @see spinlock.c. */
     int irq_enabled;            /**< Indicates if interrupts were enabled before pushcli(). */
-    /* Cpu-local storage variables; see below. (curr_cpu & curr_proc) Not implemented properly in ARM xv6. */
+    volatile int asid_flush;    /**< Set on ASID rollover; the TLB must be flushed before the next switchuvm(). */
+    /* Cpu-local storage variables; see below. (curr_cpu & curr_proc) */
     struct cpu* cpu;            /**< A self-reference to the CPU, used for CPU local storage. */
     struct proc* proc;          /**< The currently running process. */
 };
@@ -65,50 +66,55 @@ struct cpu cpus[NCPU];
  * @var ncpu - The number of actual processors present
  * on the system.
  *
- * @todo impliment mp.c including ncpu.
+ * CPUs 0 to ncpu - 1 are started. @see mp.c
  */
-/* extern int ncpu; */
+extern int ncpu;
 
 
-/** @todo - Impliment these for MP.
- * x86 version:  seginit sets up the
- * %gs segment register so that %gs refers to the memory
- * holding those two variables in the local cpu's struct cpu.
- * This is similar to how thread-local variables are implemented
- * in thread libraries such as Linux pthreads.
- * extern struct cpu *cpu asm("%gs:0");     was &cpus[cpunum()]
- * extern struct proc *proc asm("%gs:4");   was cpus[cpunum()].proc
+/**
+ * Returns the current CPU's struct cpu.
+ *
+ * Each CPU keeps a pointer to its own struct cpu in the
+ * privileged-only thread ID register (TPIDRPRW), set by
+ * set_this_cpu() when the CPU starts.
+ *
+ * @return The struct cpu of the executing CPU.
  */
+static inline struct cpu* this_cpu(void)
+{
+    struct cpu* c;
+    asm volatile("mrc p15, 0, %0, c13, c0, 4" : "=r"(c));
+    return c;
+}
+
+
+/**
+ * Records the executing CPU's struct cpu in TPIDRPRW.
+ *
+ * @param c - The struct cpu of the executing CPU.
+ */
+static inline void set_this_cpu(struct cpu* c)
+{
+    asm volatile("mcr p15, 0, %0, c13, c0, 4" : : "r"(c));
+}
 
 
 /**
  * @def curr_cpu (current_cpu) - a pointer the the CPU which
  * retrieves the variable.
- *
- * @todo Implement a multiprocessor version of curr_cpu. This could
- * be stored on a processor local register (if one exists), a macro
- * script, or use a MMU segment to redirect the variables to the
- * variable in the local CPU's struct (see the x86 version.)
- *
- * @todo Depending on the approach, this may require cpunum() to be
- * implemented.
  */
-#define curr_cpu (&cpus[0])
+#define curr_cpu (this_cpu())
 
 
 /**
  * @def curr_proc (current_cpu) - a pointer the the PCB for the
  * process which the current CPU is running.
  *
- * @todo Implement a multiprocessor version of curr_pcb. This could
- * be stored on a processor local register (if one exists), a macro
- * script, or use a MMU segment to redirect the variables to the
- * variable in the local CPU's struct (see the x86 version.)
- *
- * @todo Depending on the approach, this may require cpunum() to be
- * implemented.
+ * A process always runs on the CPU of its run queue, so the
+ * value can not change under a running process even if it is
+ * interrupted.
  */
-#define curr_proc   (cpus[0].proc)
+#define curr_proc   (curr_cpu->proc)
 
 
 /**
@@ -172,6 +178,20 @@ enum proc_state {
 };
 
 
+/**
+ * @struct vmseg - A loadable segment of a process' executable.
+ *
+ * exec() records where each segment's file contents belong
+ * instead of reading them in, and pagefault() reads each page
+ * from the executable the first time it is touched.
+ */
+struct vmseg {
+    u_int32 va;                  /**< Virtual address of the segment. */
+    u_int32 off;                 /**< Offset of the segment in the executable. */
+    u_int32 filesz;              /**< Bytes of the segment stored in the executable. */
+};
+
+
 /**
  * @struct proc - The PBC block containing information about
  * a process.
@@ -184,6 +204,7 @@ struct proc {
     /* Does sz refer to the process' heap size, or heap + stack + text + data? */
     u_int32 sz;                  /**< Size of memory allocated to the process. */
     pde_t* pgdir;                /**< Page table (Page Directory. */
+    u_int32 context_id;          /**< ASID generation and ASID the process runs with. @see asidget() in vm.c */
     char* kstack;                /**< 'Top' of the process' kernel stack (lowest address.) */
     enum proc_state state;       /**< Process state. */
     volatile int pid;            /**< Process ID. */
@@ -191,8 +212,18 @@ struct proc {
     struct trapframe* tf;        /**< Trap frame for the current system call. */
     struct context* context;     /**< swtch() to the process stack (here) to run. */
     void* channel;                  /**< If not 0, process is sleeping until wakeup is called on 'chan.' */
+    struct proc* wq_next;        /**< Next process sleeping in the same wait channel bucket. */
+    int rq_cpu;                  /**< Index of the CPU whose run queue holds the process. */
+    struct proc* rq_next;        /**< Next process in the run queue. */
+    int priority;                /**< Scheduling priority, 0 (highest) to NPRIO - 1. */
+    int slice;                   /**< Clock ticks left before the process is preempted. */
     int killed;                  /**< Non-zero if the process has been killed. */
+    unsigned long long wakeat;   /**< System time, in microseconds, to wake up at. @see timerwait() in timer.c */
+    int timerslot;               /**< Index in the timer heap while waiting for wakeat, or -1. */
     struct file* ofile[NOFILE];  /**< Index of files opened by the process. */
     struct inode* cwd;           /**< Current working directory of the process. */
+    struct inode* exe;           /**< Executable to page text and data in from, or 0. */
+    struct vmseg seg[NSEG];      /**< Loadable segments of exe. */
+    int nseg;                    /**< Number of entries in seg. */
     char name[16];               /**< Process name, for debugging only. */
 };
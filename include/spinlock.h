@@ -32,7 +32,7 @@ struct spinlock {
      * @var locked - Indicates if the lock is held by another thread.
      * Value is Non-zero if locked, zero otherwise.
      */
-    u_int32 locked;
+    volatile u_int32 locked;
 
     /** @var name - assigned to the lock for debugging purposes. */
     char *name;
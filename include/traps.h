@@ -37,13 +37,49 @@
 /** The data abort trap code. */
 #define T_DABT      0x04
 
+/** The Data Fault Status Register bit set if the abort was a write. */
+#define DFSR_WNR            (1 << 11)
 
-/** The system timer bit in irq_pending register 0. */
+/** The fault status field of the Data Fault Status Register. */
+#define DFSR_FS(dfsr)       (((dfsr) & 0xF) | (((dfsr) >> 6) & 0x10))
+
+/** The fault status of a permission fault on a small page. */
+#define DFSR_FS_PERM_PAGE   0xF
+
+/** The fault status of a translation fault on a section (no page table). */
+#define DFSR_FS_TRANS_SECT  0x5
+
+/** The fault status of a translation fault on a small page. */
+#define DFSR_FS_TRANS_PAGE  0x7
+
+
+/** The system timer compare 3 bit in irq_pending register 0: deadlines. */
 #define IRQ_TIMER_BIT       3
 
+/** The system timer compare 1 bit in irq_pending register 0: CPU 0's tick. */
+#define IRQ_TICK_BIT        1
+
 /** The miniUART bit in irq_pending register 0. */
 #define IRQ_MINIUART_BIT    29
 
+/** The bit of DMA channel n (0-12) in irq_pending register 0. */
+#define IRQ_DMA_BIT(n)      (16+(n))
+
+/** The bits of DMA channels 0-12 in irq_pending register 0. */
+#define IRQ_DMA_BITS        0x1FFF0000
+
+/** The EMMC (SD card) bit in irq_pending register 1: GPU IRQ 62. */
+#define IRQ_EMMC_BIT        30
+
 
 /** The virtual address of the interrupt control registers. */
 #define INT_REGS_BASE 	(MMIO_VA+0xB200)
+
+/** Core n's generic timer interrupt control register (BCM2836). */
+#define LOCAL_TIMER_INT_CTRL(n)     (LOCAL_VA+0x40+4*(n))
+
+/** Core n's IRQ source register (BCM2836). */
+#define LOCAL_IRQ_SOURCE(n)         (LOCAL_VA+0x60+4*(n))
+
+/** The secure and non-secure physical timer bits in both registers. */
+#define LOCAL_IRQ_CNTP              0x3
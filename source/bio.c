@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -13,85 +13,272 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 // 
-// The implementation uses three state flags internally:
+// The implementation uses these state flags internally:
 // * B_BUSY: the block has been returned from bread
 //     and has not been passed back to brelse.  
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ERROR: the disk driver gave up on the buffer's
+//     last transfer; bread and bwrite panic.
+//
+// The number of buffers is chosen at boot from the amount of
+// physical memory. Buffers are hashed on (dev, sector) into
+// NBUCKET buckets, each with its own lock and its own MRU list
+// through prev/next, so a cache hit only takes one bucket lock.
+// A miss takes bcache.lock, which serializes eviction: it first
+// uses a never-used buffer, and otherwise recycles a clean buffer
+// chosen by CLOCK. Every buffer is on one ring through cnext;
+// brelse() sets a buffer's ref bit under its bucket lock, and the
+// hand, moving round the ring, gives a referenced buffer a second
+// chance by clearing the bit, and takes the first clean, non-busy
+// buffer whose bit is clear. So a hit still only takes a bucket
+// lock, and the buffer taken is one not used for a full turn.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "fs.h"
+#include "kstat.h"
 
-struct {
+#if BSIZE > PGSIZE
+#error "BSIZE must not be larger than PGSIZE"
+#endif
+
+#define NBUCKET   1021  // hash buckets (prime)
+#define BCACHE_RAM 256  // use 1/BCACHE_RAM of memory for buffers
+#define MAXBUF    4096  // upper bound on the number of buffers
+
+extern unsigned int pm_size;
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // most recently used
+  struct buf *tail;  // least recently used
+  u_int32 hits;
+};
+
+struct {
+  struct spinlock lock;  // serializes misses; protects the fields below
+  int nbuf;
+  struct buf *unused;    // never-used buffers, through next
+  struct buf *hand;      // CLOCK hand, on the ring through cnext
+  u_int32 misses;
+  u_int32 evicts;
+  u_int32 aheads;
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(u_int32 dev, u_int32 sector)
+{
+  return &bcache.bucket[(dev * 31 + sector) % NBUCKET];
+}
+
+// Unlink b from bucket bk. Caller holds bk->lock.
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  else
+    bk->tail = b->prev;
+}
+
+// Make b the most recently used buffer of bucket bk.
+// Caller holds bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  else
+    bk->tail = b;
+  bk->head = b;
+}
+
+// Allocate the buffers. Called after kinit2(),
+// once the size of physical memory is known.
 void
 binit(void)
 {
   struct buf *b;
+  char *hdr, *data;
+  int i, n, nhdr, ndata;
 
   memset(&bcache, 0, sizeof(bcache));
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+
+  n = pm_size / BCACHE_RAM / (sizeof(struct buf) + BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+  if(n > MAXBUF)
+    n = MAXBUF;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Carve buffers, and separately their BSIZE data
+  // blocks, out of whole pages.
+  hdr = data = 0;
+  nhdr = ndata = 0;
+  while(bcache.nbuf < n){
+    if(nhdr == 0 && (hdr = kalloc()) != 0){
+      memset(hdr, 0, PGSIZE);
+      nhdr = PGSIZE / sizeof(struct buf);
+    }
+    if(ndata == 0 && (data = kalloc()) != 0)
+      ndata = PGSIZE / BSIZE;
+    if(nhdr == 0 || ndata == 0)
+      break;
+    b = (struct buf*)hdr;
+    hdr += sizeof(struct buf);
+    nhdr--;
+    b->data = (u_char8*)data;
+    data += BSIZE;
+    ndata--;
     b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.unused;
+    bcache.unused = b;
+    if(bcache.hand == 0)
+      b->cnext = b;
+    else {
+      b->cnext = bcache.hand->cnext;
+      bcache.hand->cnext = b;
+    }
+    bcache.hand = b;
+    bcache.nbuf++;
   }
+  if(bcache.nbuf < NBUF)
+    panic("binit: no memory");
+  cprintf("binit: %d buffers\n", bcache.nbuf);
+}
+
+// Find a buffer to hold a new block: a never-used one if
+// there is one, else the clean buffer the CLOCK hand comes
+// to, which is unlinked from its bucket. Two turns of the
+// hand find any clean, non-busy buffer.
+// Caller holds bcache.lock and the lock of bucket own.
+static struct buf*
+bevict(struct bucket *own)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i, found;
+
+  if((b = bcache.unused) != 0){
+    bcache.unused = b->next;
+    return b;
+  }
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    // Every buffer is in a bucket now, and its dev and
+    // sector only change under bcache.lock.
+    b = bcache.hand = bcache.hand->cnext;
+    bk = bhash(b->dev, b->sector);
+    if(bk != own)
+      acquire(&bk->lock);
+    found = 0;
+    if((b->flags & (B_BUSY|B_DIRTY)) == 0){
+      if(b->ref)
+        b->ref = 0;
+      else {
+        bunlink(bk, b);
+        found = 1;
+      }
+    }
+    if(bk != own)
+      release(&bk->lock);
+    if(found){
+      bcache.evicts++;
+      return b;
+    }
+  }
+  return 0;
 }
 
 // Look through buffer cache for sector on device dev.
 // If not found, allocate fresh block.
 // In either case, return B_BUSY buffer.
+// With ahead set, only allocate a fresh block: return 0,
+// without waiting, if the sector is cached or no buffer
+// is free.
 static struct buf*
-bget(u_int32 dev, u_int32 sector)
+bget(u_int32 dev, u_int32 sector, int ahead)
 {
+  struct bucket *bk;
   struct buf *b;
+  int locked;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, sector);
+  locked = 0;
+  acquire(&bk->lock);
 
  loop:
   // Is the sector already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b != 0; b = b->next){
     if(b->dev == dev && b->sector == sector){
+      if(ahead){
+        release(&bk->lock);
+        if(locked)
+          release(&bcache.lock);
+        return 0;
+      }
       if(!(b->flags & B_BUSY)){
         b->flags |= B_BUSY;
-        release(&bcache.lock);
+        bk->hits++;
+        release(&bk->lock);
+        if(locked)
+          release(&bcache.lock);
         return b;
       }
-      sleep(b, &bcache.lock);
+      if(locked){
+        release(&bcache.lock);
+        locked = 0;
+      }
+      sleep(b, &bk->lock);
       goto loop;
     }
   }
 
-  // Not cached; recycle some non-busy and clean buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
+  // Not cached. Take the eviction lock, which must come
+  // before any bucket lock, and look again.
+  if(!locked){
+    release(&bk->lock);
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+    locked = 1;
+    goto loop;
+  }
+
+  // Recycle some non-busy and clean buffer.
+  if((b = bevict(bk)) == 0){
+    if(ahead){
+      release(&bk->lock);
       release(&bcache.lock);
-      return b;
+      return 0;
     }
+    panic("bget: no buffers");
   }
-  panic("bget: no buffers");
-  return 0;
+  bcache.misses++;
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY;
+  b->ref = 0;
+  bpush(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -100,12 +287,34 @@ bread(u_int32 dev, u_int32 sector)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
-  if(!(b->flags & B_VALID))
+  b = bget(dev, sector, 0);
+  if(!(b->flags & B_VALID)){
     iderw(b);
+    if(b->flags & B_ERROR)
+      panic("bread: I/O error");
+  }
   return b;
 }
 
+// Start reading the indicated disk sector into the cache,
+// unless it is already cached, without waiting for the
+// read to finish.  A later bread() of the sector waits
+// for it, as the buffer stays B_BUSY until the driver
+// has read it and released it.
+void
+breadahead(u_int32 dev, u_int32 sector)
+{
+  struct buf *b;
+
+  if((b = bget(dev, sector, 1)) == 0)
+    return;
+  acquire(&bcache.lock);
+  bcache.aheads++;
+  release(&bcache.lock);
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
 // Write b's contents to disk.  Must be B_BUSY.
 void
 bwrite(struct buf *b)
@@ -114,28 +323,54 @@ bwrite(struct buf *b)
     panic("bwrite");
   b->flags |= B_DIRTY;
   iderw(b);
+  if(b->flags & B_ERROR)
+    panic("bwrite: I/O error");
 }
 
 // Release a B_BUSY buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list, and mark
+// it used for the CLOCK hand.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->sector);
+  acquire(&bk->lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  bunlink(bk, b);
+  bpush(bk, b);
 
+  b->ref = 1;
   b->flags &= ~B_BUSY;
-  wakeup(b);
+  wakeup_one(b);
 
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Copy up to n bytes of buffer cache statistics,
+// as a struct bcachestat, into dst.
+// Returns the number of bytes copied.
+int
+bcachestat(char *dst, int n)
+{
+  struct bcachestat st;
+  int i;
+
+  acquire(&bcache.lock);
+  st.nbuf = bcache.nbuf;
+  st.misses = bcache.misses;
+  st.evicts = bcache.evicts;
+  st.aheads = bcache.aheads;
+  release(&bcache.lock);
+  st.hits = 0;
+  for(i = 0; i < NBUCKET; i++)
+    st.hits += bcache.bucket[i].hits;
+  if(n > sizeof(st))
+    n = sizeof(st);
+  memmove(dst, &st, n);
+  return n;
+}
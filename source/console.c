@@ -16,6 +16,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "arm.h"
+#include "mailbox.h"
 
 #define BACKSPACE 0x100
 
@@ -26,6 +27,7 @@ static struct {
 	int locking;
 } cons;
 
+static void consputs(char*, int);
 
 u_int32 cursor_x=0, cursor_y=0;
 u_int32 frameheight=1024, framewidth=1280, framedepth=16;
@@ -34,23 +36,34 @@ frame_buf_desc fbinfo __attribute__ ((aligned (16), nocommon));
 
 extern volatile u_int32 *mail_buffer;
 extern u_char8 font[];
-static u_int32 gpucolour=0xffff;
 
-void setgpucolour(u_short16 c)
-{
-	gpucolour = c;
-}
+// The console scrolls by panning the display down a virtual
+// framebuffer twice the screen's height, rather than by copying
+// the screen up a line. The virtual framebuffer holds every line
+// twice, frameheight apart, so that the screen shows a whole
+// screen of text wherever it starts within the upper half.
+static int fbpan;           // the virtual framebuffer is double height
+static u_int32 fbtop;       // virtual y of the top of the screen
+static u_int32 fbpitch;     // bytes per line of pixels
+static u_int32 fbshown;     // virtual y of the top of the display
+
+// The font, expanded to 16-bit white on black pixels: the
+// eight pixels of each possible row of a glyph, as four words.
+static u_int32 fontexp[256][4];
 
+// A property message for panning, apart from mail_buffer
+// so that it may be sent at any time.
+static volatile u_int32 panbuf[8] __attribute__ ((aligned (16)));
 
 
-u_int32 initframebuf(u_int32 width, u_int32 height, u_int32 depth)
+u_int32 initframebuf(u_int32 width, u_int32 height, u_int32 vheight, u_int32 depth)
 {
   
 
 	fbinfo.width = width;
 	fbinfo.height = height;
 	fbinfo.v_width = width;
-	fbinfo.v_height = height;
+	fbinfo.v_height = vheight;
 	fbinfo.pitch = 0;
 	fbinfo.depth = depth;
 	fbinfo.x = 0;
@@ -73,23 +86,10 @@ struct {
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-	int i;
-
 	//  cprintf("consolewrite is called: ip=%x buf=%x, n=%x", ip, buf, n);
 	iunlock(ip);
 	acquire(&cons.lock);
-	for(i = 0; i < n; i++){
-#if defined (RPI1)
-		gpuputc(buf[i] & 0xff);
-		uartputc(buf[i] & 0xff);
-#elif defined (RPI2)
-		gpuputc(buf[i] & 0xff);
-		uartputc(buf[i] & 0xff);
-#elif defined (FVP)
-		uartputc_fvp(buf[i] & 0xff);
-#endif
-
-	}
+	consputs(buf, n);
 	release(&cons.lock);
 	ilock(ip);
 
@@ -97,135 +97,207 @@ consolewrite(struct inode *ip, char *buf, int n)
 }
 
 
-void drawpixel(u_int32 x, u_int32 y)
+// Return the address of pixel row y of the virtual framebuffer.
+static u_int32*
+fbrow(u_int32 y)
 {
-	u_short16 *addr;
+	return (u_int32 *)(fbinfo.fbp + y*fbpitch);
+}
 
-	if(x >= framewidth || y >= frameheight) return;
-	addr = (u_short16 *) fbinfo.fbp;
-	addr += y*framewidth + x;
-	*addr = gpucolour;
-	return;
+// Blit one glyph cell, at x and screen row y, to the screen
+// and to its copy in the other half of the virtual framebuffer.
+// A glyph of 0 blits a blank cell. The last row of a cell
+// is left blank, to space the lines of text.
+static void
+gpuglyph(u_char8 *glyph, u_int32 x, u_int32 y)
+{
+	u_int32 *p, *q, *e;
+	u_int32 row, vy;
+
+	vy = fbtop + y;
+	p = fbrow(vy) + x/2;
+	q = fbrow(vy < frameheight ? vy + frameheight : vy - frameheight) + x/2;
+	for(row = 0; row < fontheight; row++){
+		e = fontexp[glyph && row < fontheight-1 ? glyph[row] : 0];
+		p[0] = e[0]; p[1] = e[1]; p[2] = e[2]; p[3] = e[3];
+		p += fbpitch/4;
+		if(fbpan){
+			q[0] = e[0]; q[1] = e[1]; q[2] = e[2]; q[3] = e[3];
+			q += fbpitch/4;
+		}
+	}
 }
 
+void drawcharacter(u_char8 c, u_int32 x, u_int32 y)
+{
+	if(x + fontwidth > framewidth || y + fontheight > frameheight) return;
+	gpuglyph(c > 127 ? 0 : font + ((u_int32)c << 4), x, y);
+}
 
-void drawcursor(u_int32 x, u_int32 y)
+// Clear the line of text at screen row y.
+static void
+gpuclearline(u_int32 y)
 {
-	u_char8 row, bit;
+	u_int32 vy;
 
-	for(row=0; row<15; row++)
-		for(bit=0; bit<8; bit++)
-			drawpixel(x+bit, y+row);
+	vy = fbtop + y;
+	memset(fbrow(vy), 0, fontheight*fbpitch);
+	if(fbpan)
+		memset(fbrow(vy < frameheight ? vy + frameheight : vy - frameheight), 0, fontheight*fbpitch);
 }
 
-void drawcharacter(u_char8 c, u_int32 x, u_int32 y)
+// Show the virtual framebuffer from row y down.
+static void
+gpupan(u_int32 y)
 {
-	u_char8 *faddr;
-	u_char8 row, bit, bits;
-	u_int32 tv;
-
-	if(c > 127) return;
-	tv = ((u_int32)c) << 4;
-	faddr = font + tv;
-	for(row=0; row<15; row++){
-		bits = *(faddr+row);
-		for(bit=0; bit<8; bit++){
-			if((bits>>bit) & 1) drawpixel(x+bit, y+row);
-		}
-	}
+	u_int32 data[2];
 
+	data[0] = 0;
+	data[1] = y;
+	create_request(panbuf, MPI_TAG_SET_VIRTUAL_OFFSET, 8, 8, data);
+	writemailbox((u_int32 *)panbuf, 8);
+	readmailbox(8);
 }
 
-//static void
-void
-gpuputc(u_int32 c)
+// Scroll the screen up one line of text. Without a double
+// height virtual framebuffer, copy the screen up; it is not
+// cached, so the DMA engine copies it faster than the CPU.
+static void
+gpuscroll(void)
 {
-	#if defined (RPI1) || defined (RPI2)
-
-	if(fbinfo.fbp == 0) return;
+	u_char8 *fb;
+	u_int32 line, n;
+
+	if(fbpan){
+		fbtop += fontheight;
+		if(fbtop >= frameheight)
+			fbtop -= frameheight;
+		// The new bottom line was the top line: clear it.
+		// gpushow() pans to it.
+		gpuclearline(frameheight - fontheight);
+		return;
+	}
+	fb = (u_char8 *)fbinfo.fbp;
+	line = fontheight*fbpitch;
+	n = (frameheight - fontheight)*fbpitch;
+	if(dmacopy(fb, fb + line, n) < 0)
+		memmove(fb, fb + line, n);
+	gpuclearline(frameheight - fontheight);
+}
 
+// Draw character c at the cursor, and move it on. The display
+// is not panned to show a scroll until gpushow().
+static void
+gpudraw(u_int32 c)
+{
 	if(c=='\n'){
 		cursor_x = 0;
 		cursor_y += fontheight;
-		if(cursor_y >= frameheight) {
-			memmove((u_char8 *)fbinfo.fbp, (u_char8 *)fbinfo.fbp+framewidth*fontheight*2, (frameheight - fontheight)*framewidth*2);
-			cursor_y = frameheight - fontheight;
-			setgpucolour(0);
-			while(cursor_x < framewidth) {
-				drawcursor(cursor_x, cursor_y);
-				cursor_x = cursor_x + fontwidth;
-			}
-			setgpucolour(0xffff);
-			cursor_x = 0;
-		}
 	} else if(c == BACKSPACE) {
 		if (cursor_x > 0) {
 			cursor_x -= fontwidth;
-			setgpucolour(0);
-			drawcursor(cursor_x, cursor_y);
-			setgpucolour(0xffff);
+			gpuglyph(0, cursor_x, cursor_y);
 		}
 	} else {
-		setgpucolour(0);
-		drawcursor(cursor_x, cursor_y);
-		setgpucolour(0xffff);
-		if(c!=' ') drawcharacter(c, cursor_x, cursor_y);
+		drawcharacter(c, cursor_x, cursor_y);
 		cursor_x = cursor_x + fontwidth;
 		if(cursor_x >= framewidth) {
 			cursor_x = 0;
 			cursor_y += fontheight;
-			if(cursor_y >= frameheight) {
-				memmove((u_char8 *)fbinfo.fbp, (u_char8 *)fbinfo.fbp+framewidth*fontheight*2, (frameheight - fontheight)*framewidth*2);
-				cursor_y = frameheight - fontheight;
-				setgpucolour(0);
-				while(cursor_x < framewidth) {
-					drawcursor(cursor_x, cursor_y);
-					cursor_x = cursor_x + fontwidth;
-				}
-				setgpucolour(0xffff);
-				cursor_x = 0;
-			}
 		}
 	}
+	if(cursor_y >= frameheight) {
+		gpuscroll();
+		cursor_y = frameheight - fontheight;
+	}
+}
+
+// Pan the display to the lines drawn, once for
+// however many lines were scrolled.
+static void
+gpushow(void)
+{
+	if(fbpan && fbshown != fbtop){
+		gpupan(fbtop);
+		fbshown = fbtop;
+	}
+}
+
+//static void
+void
+gpuputc(u_int32 c)
+{
+	#if defined (RPI1) || defined (RPI2)
+	if(fbinfo.fbp == 0) return;
+	gpudraw(c);
+	gpushow();
+	#endif
+}
+
+// Draw n characters from s.
+void
+gpuputs(char *s, int n)
+{
+	#if defined (RPI1) || defined (RPI2)
+	int i;
+
+	if(fbinfo.fbp == 0) return;
+	for(i = 0; i < n; i++)
+		gpudraw(s[i] & 0xff);
+	gpushow();
 	#endif
+}
+
+// Write n characters from s to the console, as one span:
+// the UART queues them under one lock, and the display
+// pans once for any lines they scroll.
+static void
+consputs(char *s, int n)
+{
+	#if defined (RPI1) || defined (RPI2)
+	gpuputs(s, n);
+	uartputs(s, n);
+	#elif defined (FVP)
+	int i;
 
+	for(i = 0; i < n; i++)
+		uartputc_fvp(s[i] & 0xff);
+	#endif
 }
 
 
+// Print xx in base 10 or 16. The digits are found without
+// div(): in hex by shifts, and in decimal by multiplying by
+// 2^35/10, rounded up, which gives the exact quotient for
+// any 32-bit x.
 static void
 printint(int xx, int base, int sign)
 {
-	static u_char8 digits[] = "0123456789abcdef";
-	u_char8 buf[16];
+	static char digits[] = "0123456789abcdef";
+	char buf[16];
 	int i;
-	u_int32 x, y, b;
+	u_int32 x, q;
 
 	if(sign && (sign = xx < 0))
 		x = -xx;
 	else
 		x = xx;
 
-	b = base;
-	i = 0;
+	i = sizeof(buf);
 	do{
-		y = div(x, b);
-		buf[i++] = digits[x - y * b];
-	}while((x = y) != 0);
+		if(base == 16){
+			buf[--i] = digits[x & 0xf];
+			x >>= 4;
+		} else {
+			q = ((unsigned long long)x * 0xCCCCCCCDU) >> 35;
+			buf[--i] = digits[x - q*10];
+			x = q;
+		}
+	}while(x != 0);
 
 	if(sign)
-		buf[i++] = '-';
-
-	while(--i >= 0){
-		#if defined (RPI1)
-		gpuputc(buf[i]);
-		uartputc(buf[i]);
-		#elif defined (RPI2)
-		gpuputc(buf[i]);
-		uartputc(buf[i]);
-		#elif defined (FVP)
-		uartputc_fvp(buf[i]);
-		#endif
-	}
+		buf[--i] = '-';
+	consputs(buf + i, sizeof(buf) - i);
 }
 
 
@@ -233,7 +305,7 @@ printint(int xx, int base, int sign)
 void
 cprintf(char *fmt, ...)
 {
-	int i, c;
+	int i, c, n;
 	int locking;
 	u_int32 *argp;
 	char *s;
@@ -248,15 +320,11 @@ cprintf(char *fmt, ...)
 	argp = (u_int32 *)(void*)(&fmt + 1);
 	for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
 		if(c != '%'){
-			#if defined (RPI1)
-			gpuputc(c);
-			uartputc(c);
-			#elif defined (RPI2)
-			gpuputc(c);
-			uartputc(c);
-			#elif defined (FVP)
-			uartputc_fvp(c);
-			#endif
+			// Write the run of text up to the next % at once.
+			for(n = 1; fmt[i+n] != 0 && fmt[i+n] != '%'; n++)
+				;
+			consputs(fmt + i, n);
+			i += n - 1;
 			continue;
 		}
 		c = fmt[++i] & 0xff;
@@ -273,45 +341,14 @@ cprintf(char *fmt, ...)
 		case 's':
 			if((s = (char*)*argp++) == 0)
 				s = "(null)";
-			for(; *s; s++){
-				#if defined (RPI1)
-				gpuputc(*s);
-				uartputc(*s);
-				#elif defined (RPI2)
-				gpuputc(*s);
-				uartputc(*s);
-				#elif defined (FVP)
-				uartputc_fvp(*s);
-				#endif
-			}
+			consputs(s, strlen(s));
 			break;
 		case '%':
-			#if defined (RPI1)
-			gpuputc('%');
-			uartputc('%');
-			#elif defined (RPI2)
-			gpuputc('%');
-			uartputc('%');
-			#elif defined (FVP)
-			uartputc_fvp('%');
-			#endif
+			consputs("%", 1);
 			break;
 		default:
 			// Print unknown % sequence to draw attention.
-			#if defined (RPI1)
-			gpuputc('%');
-			uartputc('%');
-			gpuputc(c);
-			uartputc(c);
-			#elif defined (RPI2)
-			gpuputc('%');
-			uartputc('%');
-			gpuputc(c);
-			uartputc(c);
-			#elif defined (FVP)
-			uartputc_fvp('%');
-			uartputc_fvp(c);
-			#endif
+			consputs(fmt + i - 1, 2);
 			break;
 		}
 	}
@@ -325,6 +362,9 @@ panic(char *s)
 	int i;
 	u_int32 pcs[10];
 
+	#if defined (RPI1) || defined (RPI2)
+	uartflush(); // the UART's interrupt may never come
+	#endif
 	cprintf("cpu%d: panic: ", 0);
 	cprintf(s);
 	cprintf("\n");
@@ -451,7 +491,11 @@ void gpuinit()
 {
 	#if defined (RPI1) || defined (RPI2)
 	u_int32 fbinforesp;
-	fbinforesp = initframebuf(framewidth, frameheight, framedepth);
+	u_int32 i, b;
+
+	fbinforesp = initframebuf(framewidth, frameheight, 2*frameheight, framedepth);
+	if(fbinforesp != 0)
+		fbinforesp = initframebuf(framewidth, frameheight, frameheight, framedepth);
 	if(fbinforesp != 0){
 		fbinfo.fbp = 0;
 		cprintf("Failed to initialize GPU framebuffer!\n");
@@ -461,6 +505,19 @@ void gpuinit()
 	// convert the address into ARM space and then to the ARM VM space for the whole physical address space
 	fbinfo.fbp = (fbinfo.fbp & 0x3fffffff) + 0x40000000;
 	//cprintf("The frame buffer pointer is %x\n", fbinfo.fbp);
+	if(fbinfo.pitch == 0)
+		fbinfo.pitch = framewidth*2;
+	fbpitch = fbinfo.pitch;
+	fbpan = fbinfo.fbs >= 2*frameheight*fbpitch;
+	fbtop = 0;
+	mmu_gpumem_wc(fbinfo.fbp, fbinfo.fbs);
+	memset((void *)fbinfo.fbp, 0, fbinfo.fbs);
+
+	// Expand each row of eight pixels, leftmost in bit 0.
+	for(b = 0; b < 256; b++)
+		for(i = 0; i < 4; i++)
+			fontexp[b][i] = ((b >> 2*i) & 1 ? 0xffff : 0) |
+			    ((b >> (2*i+1)) & 1 ? 0xffff0000 : 0);
         #endif
 
 
@@ -0,0 +1,61 @@
+/**
+ * @file div.c
+ *
+ * div.c provides integer division for the cores without a hardware
+ * divider: the ARM1176 (hw=rpi1) and the Cortex-A9 (hw=fvp).
+ *
+ * C code divides by a divisor not known at compile time with udiv()
+ * and umod() in arm.h, which use the Cortex-A7's UDIV instruction on
+ * hw=rpi2, shift for a power of two divisor, and otherwise call div().
+ *
+ * div.c can also be built on an ARM Linux host, with div renamed
+ * (DIV_HOST), for tools/divbench.c.
+ *
+ * @see udiv() and umod() in arm.h.
+ */
+
+
+#include "types.h"
+
+#ifdef DIV_HOST
+#define div k_div
+#endif
+
+
+/**
+ * Computes integer division.
+ *
+ * div ("Division") computes the integer long division of 'n' / 'd'.
+ *
+ * The divisor is first shifted up to the highest set bit of 'n', so
+ * the shift-and-subtract loop runs once per bit of the quotient,
+ * rather than 32 times. A power of two divisor is a shift.
+ *
+ * @param n - The numerator to divide.
+ * @param d  - The denominator to divide by. As with UDIV, dividing
+ * by zero gives zero.
+ * @return - The integer quotient of 'n' and 'd'.
+ */
+u_int32 div(u_int32 n, u_int32 d)
+{
+    u_int32 q = 0;
+    int i;
+
+    if (d == 0 || n < d) {
+        return 0;
+    }
+    if ((d & (d - 1)) == 0) {
+        return n >> __builtin_ctz(d);
+    }
+    i = __builtin_clz(d) - __builtin_clz(n);
+    d = d << i;
+    for (; i >= 0; i--) {
+        q = q << 1;
+        if (n >= d) {
+            n = n - d;
+            q = q | 1;
+        }
+        d = d >> 1;
+    }
+    return q;
+}
@@ -0,0 +1,282 @@
+// Memory-to-memory copies by the BCM2835 DMA engine.
+//
+// dmacopy() describes a copy as a chain of control blocks, each
+// moving up to DMA_CHUNK bytes, and hands the chain to one DMA
+// channel, which the firmware reports free. A caller which may
+// sleep sleeps until the channel's interrupt reports the chain
+// done, so the CPU can run something else meanwhile. A caller
+// holding a spinlock polls for completion instead, and does not
+// wait for a channel already in use. Either way, dmacopy()
+// fails rather than waits when the copy can not be offloaded,
+// and the caller then copies with memmove().
+//
+// The engine sees physical memory, not the caches: the source
+// and destination are flushed with flush_dcache() first, and
+// the destination again afterwards, in case lines were loaded
+// into the cache during the copy.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "arm.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "mailbox.h"
+
+#define DMA_BASE          (MMIO_VA+0x007000)
+#define DMA_CH(n)         (DMA_BASE + 0x100*(n))
+#define DMA_ENABLE        (DMA_BASE+0xFF0)
+
+// Channel registers.
+#define DMA_CS            0x00
+#define DMA_CONBLK_AD     0x04
+#define DMA_DEBUG         0x20
+
+// DMA_CS
+#define CS_ACTIVE         (1<<0)
+#define CS_END            (1<<1)
+#define CS_INT            (1<<2)
+#define CS_ERROR          (1<<8)
+#define CS_PRIORITY(n)    ((n)<<16)
+#define CS_PANIC_PRIORITY(n) ((n)<<20)
+#define CS_WAIT_WRITES    (1<<28)
+#define CS_RESET          (1U<<31)
+
+// Transfer information, in a control block.
+#define TI_INTEN          (1<<0)
+#define TI_WAIT_RESP      (1<<3)
+#define TI_DEST_INC       (1<<4)
+#define TI_SRC_INC        (1<<8)
+#define TI_BURST(n)       ((n)<<12)
+
+// The bus address of ARM physical address 0: through the GPU's
+// L2 cache on the RPi 1, which the ARM shares, and uncached on
+// the RPi 2.
+#ifdef RPI1
+#define DMA_BUSALIAS      0x40000000
+#else
+#define DMA_BUSALIAS      0xC0000000
+#endif
+
+#define DMA_MIN     1024       // smaller copies are left to the CPU
+#define DMA_CHUNK   (32*1024)  // most bytes per control block; lite channels take < 64KB
+#define DMA_NCB     (PGSIZE/sizeof(struct dmacb))
+
+// A control block. The engine needs them 32-byte aligned.
+struct dmacb {
+  u_int32 ti;
+  u_int32 src;
+  u_int32 dst;
+  u_int32 len;
+  u_int32 stride;
+  u_int32 next;  // bus address of the next block, or 0
+  u_int32 pad[2];
+};
+
+static struct {
+  struct spinlock lock;
+  int ch;             // the channel
+  struct dmacb *cb;   // a page of control blocks; 0 if no channel
+  int busy;           // a dmacopy() owns the channel
+  int running;        // the channel is running a chain
+  int err;            // the last chain failed
+  u_int32 errcb;      // bus address of the block it failed in
+} dma;
+
+// Return the bus address of kernel address va, as the DMA
+// engine sees it, or 0 if va is not in physical memory.
+static u_int32
+dmaaddr(void *va)
+{
+  u_int32 a;
+
+  a = (u_int32)va;
+  if(a >= KERNBASE && a - KERNBASE < PHYSIZE)
+    return v2p(va) | DMA_BUSALIAS;
+  if(a >= GPUMEMBASE && a - GPUMEMBASE < GPUMEMSIZE)
+    return (a - GPUMEMBASE) | DMA_BUSALIAS;
+  return 0;
+}
+
+// Flush n bytes at va from the data cache. The GPU memory
+// window is not cached, but writes to it may be buffered.
+static void
+dmaflush(void *va, u_int32 n)
+{
+  if((u_int32)va >= KERNBASE)
+    flush_dcache((u_int32)va, (u_int32)va + n);
+  else
+    dsb_barrier();
+}
+
+void
+dmainit(void)
+{
+#if defined (RPI1) || defined (RPI2)
+  extern volatile u_int32 *mail_buffer;
+  int_ctrl_regs *ip;
+  struct dmacb *cb;
+  u_int32 mask;
+  int i;
+#endif
+
+  initlock(&dma.lock, "dma");
+#if defined (RPI1) || defined (RPI2)
+  create_request(mail_buffer, MPI_TAG_GET_DMA_CHANNELS, 4, 0, 0);
+  writemailbox((u_int32*)mail_buffer, 8);
+  readmailbox(8);
+  if(mail_buffer[POS_RV] != MPI_RESPONSE_OK)
+    return;
+  mask = mail_buffer[MB_HEADER_LENGTH + TAG_HEADER_LENGTH];
+
+  // Prefer a full channel (1-6) to a lite one (7-10).
+  // Channel 0 is left to the firmware; the interrupts of
+  // channels 11-14 are shared.
+  for(i = 6; i >= 1; i--)
+    if(mask & (1 << i))
+      break;
+  if(i == 0)
+    for(i = 10; i >= 7; i--)
+      if(mask & (1 << i))
+        break;
+  if(i < 1 || (cb = (struct dmacb*)kalloc()) == 0)
+    return;
+  dma.ch = i;
+  dma.cb = cb;
+
+  outw(DMA_ENABLE, inw(DMA_ENABLE) | 1 << dma.ch);
+  outw(DMA_CH(dma.ch)+DMA_CS, CS_RESET);
+  ip = (int_ctrl_regs *)INT_REGS_BASE;
+  ip->irq_enable[0] |= 1 << IRQ_DMA_BIT(dma.ch);
+  cprintf("dmainit: channel %d\n", dma.ch);
+#endif
+}
+
+// The channel's chain has stopped: note whether it failed,
+// and wake its dmacopy(). Caller must hold dma.lock.
+static void
+dmadone(void)
+{
+  u_int32 cs;
+
+  cs = inw(DMA_CH(dma.ch)+DMA_CS);
+  outw(DMA_CH(dma.ch)+DMA_CS, CS_INT | CS_END);
+  if(!dma.running)
+    return;
+  dma.running = 0;
+  dma.err = (cs & CS_ERROR) != 0;
+  if(dma.err){
+    dma.errcb = inw(DMA_CH(dma.ch)+DMA_CONBLK_AD);
+    cprintf("dma: error %x, debug %x\n", cs, inw(DMA_CH(dma.ch)+DMA_DEBUG));
+    outw(DMA_CH(dma.ch)+DMA_CS, CS_RESET);
+  }
+  wakeup(&dma);
+}
+
+// Interrupt handler.
+void
+dmaintr(void)
+{
+  if(dma.cb == 0)
+    return;
+  acquire(&dma.lock);
+  dmadone();
+  release(&dma.lock);
+}
+
+// Copy n bytes from src to dst with the DMA engine. Both must
+// be kernel addresses of physical memory or of the GPU memory
+// window (such as the framebuffer). dst may overlap the end of
+// src, as when scrolling, but not its start.
+// Returns -1 if the copy should be done by the CPU instead: if
+// it is small, the blocks are unsuitable, or the engine is busy
+// or unavailable. Nothing has been copied then. If the engine
+// fails part way through, the CPU finishes the copy.
+// Sleeps until done if called by a process holding no spinlock;
+// otherwise, polls for the end of the copy.
+int
+dmacopy(void *dst, void *src, u_int32 n)
+{
+  struct dmacb *cb;
+  u_int32 d, s, off, chunk, k;
+  int canwait, i;
+
+  if(dma.cb == 0 || n < DMA_MIN)
+    return -1;
+  if((d = dmaaddr(dst)) == 0 || (s = dmaaddr(src)) == 0 ||
+     (dmaaddr((char*)dst + n - 1)) == 0 || (dmaaddr((char*)src + n - 1)) == 0)
+    return -1;
+  if((char*)dst > (char*)src && (char*)dst < (char*)src + n)
+    return -1;
+
+  // The blocks of a chain run in turn, so an overlapping
+  // copy down memory is safe in chunks no larger than the
+  // distance moved.
+  chunk = DMA_CHUNK;
+  if((char*)dst < (char*)src && (char*)src - (char*)dst < chunk)
+    chunk = (char*)src - (char*)dst;
+  if(chunk < DMA_MIN || n > chunk * DMA_NCB)
+    return -1;
+
+  pushcli();
+  canwait = curr_proc != 0 && curr_cpu->ncli == 1;
+  popcli();
+
+  acquire(&dma.lock);
+  if(dma.busy && !canwait){
+    release(&dma.lock);
+    return -1;
+  }
+  while(dma.busy)
+    sleep(&dma, &dma.lock);
+  dma.busy = 1;
+
+  for(i = 0, off = 0; off < n; i++, off += chunk){
+    cb = &dma.cb[i];
+    cb->ti = TI_SRC_INC | TI_DEST_INC | TI_WAIT_RESP | TI_BURST(4);
+    cb->src = s + off;
+    cb->dst = d + off;
+    cb->len = n - off < chunk ? n - off : chunk;
+    cb->stride = 0;
+    cb->next = dmaaddr(cb + 1);
+  }
+  cb->next = 0;
+  if(canwait)
+    cb->ti |= TI_INTEN;
+  dmaflush(dma.cb, i * sizeof(*cb));
+  dmaflush(src, n);
+  dmaflush(dst, n);
+
+  dma.running = 1;
+  outw(DMA_CH(dma.ch)+DMA_CONBLK_AD, dmaaddr(dma.cb));
+  outw(DMA_CH(dma.ch)+DMA_CS,
+       CS_ACTIVE | CS_PRIORITY(8) | CS_PANIC_PRIORITY(15) | CS_WAIT_WRITES);
+  while(dma.running){
+    if(canwait)
+      sleep(&dma, &dma.lock);
+    else if((inw(DMA_CH(dma.ch)+DMA_CS) & (CS_ACTIVE | CS_ERROR)) != CS_ACTIVE)
+      dmadone();
+  }
+  off = n;
+  if(dma.err){
+    // The blocks before the failed one are done. Each moved
+    // no more than the distance between src and dst, so none
+    // overwrote the source of a later block: redo the rest
+    // from the failed block on.
+    k = (dma.errcb - dmaaddr(dma.cb)) / sizeof(*cb);
+    if(k >= i)
+      k = i - 1;
+    off = k * chunk;
+  }
+  dmaflush(dst, n);
+
+  dma.busy = 0;
+  wakeup(&dma);
+  release(&dma.lock);
+  if(off < n)
+    memmove((char*)dst + off, (char*)src + off, n - off);
+  return 0;
+}
@@ -0,0 +1,449 @@
+// SD card driver for the BCM2835 EMMC (SDHCI) controller.
+//
+// Built instead of the memory disk in memide.c by 'make disk=emmc'.
+// Under QEMU, pass the file system image as the SD card, with
+// '-M raspi2 -drive if=sd,format=raw,file=fs.img'.
+//
+// As in xv6's IDE driver, requests wait in a queue linked through
+// buf.qnext, and the head of the queue is the transfer in flight.
+// Buffers queued behind the head whose sectors follow on from it,
+// in the same direction, join its transfer, which becomes one
+// multi-block CMD18 or CMD25 ended by an automatic CMD12. Read
+// ahead queues runs of this kind. The interrupt handler moves each
+// 512-byte card block through the data port as the controller
+// signals it ready, and completes the transfer's buffers and
+// starts the next when the controller signals it done.
+//
+// The file system starts at card block SD_FSSTART; 'make sdstart=n'
+// places it in a partition starting at block n of a real card.
+
+#ifdef EMMC
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "arm.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "fs.h"
+#include "mailbox.h"
+
+#ifndef SD_FSSTART
+#define SD_FSSTART 0
+#endif
+
+#define EMMC_BASE        (MMIO_VA+0x300000)
+#define EMMC_BLKSIZECNT  0x04
+#define EMMC_ARG1        0x08
+#define EMMC_CMDTM       0x0C
+#define EMMC_RESP0       0x10
+#define EMMC_DATA        0x20
+#define EMMC_STATUS      0x24
+#define EMMC_CONTROL0    0x28
+#define EMMC_CONTROL1    0x2C
+#define EMMC_INTERRUPT   0x30
+#define EMMC_IRPT_MASK   0x34
+#define EMMC_IRPT_EN     0x38
+
+// CMDTM: transfer mode and command.
+#define TM_BLKCNT_EN     (1<<1)
+#define TM_AUTO_CMD12    (1<<2)
+#define TM_DAT_READ      (1<<4)
+#define TM_MULTI_BLOCK   (1<<5)
+#define CMD_RSPNS_136    (1<<16)
+#define CMD_RSPNS_48     (2<<16)
+#define CMD_RSPNS_48B    (3<<16)
+#define CMD_CRCCHK       (1<<19)
+#define CMD_IXCHK        (1<<20)
+#define CMD_ISDATA       (1<<21)
+#define CMD_INDEX(n)     ((n)<<24)
+
+#define CMD_R1   (CMD_RSPNS_48|CMD_CRCCHK|CMD_IXCHK)
+#define CMD_R1B  (CMD_RSPNS_48B|CMD_CRCCHK|CMD_IXCHK)
+#define CMD_MULTI (CMD_ISDATA|TM_MULTI_BLOCK|TM_BLKCNT_EN|TM_AUTO_CMD12)
+
+// SD commands.
+#define SD_GO_IDLE       CMD_INDEX(0)
+#define SD_ALL_SEND_CID  (CMD_INDEX(2)|CMD_RSPNS_136|CMD_CRCCHK)
+#define SD_SEND_RCA      (CMD_INDEX(3)|CMD_R1)
+#define SD_SELECT        (CMD_INDEX(7)|CMD_R1B)
+#define SD_SEND_IF_COND  (CMD_INDEX(8)|CMD_R1)
+#define SD_SET_BLOCKLEN  (CMD_INDEX(16)|CMD_R1)
+#define SD_READ_ONE      (CMD_INDEX(17)|CMD_R1|CMD_ISDATA|TM_DAT_READ)
+#define SD_READ_MULTI    (CMD_INDEX(18)|CMD_R1|CMD_MULTI|TM_DAT_READ)
+#define SD_WRITE_ONE     (CMD_INDEX(24)|CMD_R1|CMD_ISDATA)
+#define SD_WRITE_MULTI   (CMD_INDEX(25)|CMD_R1|CMD_MULTI)
+#define SD_APP_CMD       (CMD_INDEX(55)|CMD_R1)
+#define SD_SET_BUS_WIDTH (CMD_INDEX(6)|CMD_R1)     // after SD_APP_CMD
+#define SD_SEND_OP_COND  (CMD_INDEX(41)|CMD_RSPNS_48) // after SD_APP_CMD
+
+// STATUS
+#define SR_CMD_INHIBIT   (1<<0)
+#define SR_DAT_INHIBIT   (1<<1)
+
+// CONTROL0
+#define C0_HCTL_DWIDTH   (1<<1)    // 4-bit data bus
+#define C0_BUS_POWER     (0xF<<8)  // bus power on, at 3.3V
+
+// CONTROL1
+#define C1_CLK_INTLEN    (1<<0)
+#define C1_CLK_STABLE    (1<<1)
+#define C1_CLK_EN        (1<<2)
+#define C1_TOUNIT_MAX    (0xE<<16)
+#define C1_SRST_HC       (1<<24)
+#define C1_SRST_CMD      (1<<25)
+#define C1_SRST_DATA     (1<<26)
+
+// INTERRUPT, IRPT_MASK and IRPT_EN
+#define INT_CMD_DONE     (1<<0)
+#define INT_DATA_DONE    (1<<1)
+#define INT_WRITE_RDY    (1<<4)
+#define INT_READ_RDY     (1<<5)
+#define INT_ERR          0xFFFF8000  // any error
+#define INT_ERRORS       0xFFFF0000  // the individual errors
+
+#define SDBLK       512          // card block size
+#define SPB         (BSIZE/SDBLK) // card blocks per file system block
+#define SD_MAXRUN   64           // most buffers in one transfer
+#define SD_RETRIES  3            // retries of a failed transfer
+#define SD_TIMEOUT  100000       // microseconds to wait for a command
+
+static struct spinlock idelock;
+static struct buf *idequeue;
+
+static struct {
+  u_int32 baseclk;  // controller base clock, in Hz
+  u_int32 rca;      // relative card address, in bits 16-31
+  int sdhc;         // block, rather than byte, addressed
+  int nbuf;         // buffers in the transfer in flight; 0 if idle
+  struct buf *cur;  // buffer of the next card block to move
+  int off;          // offset of that block in cur->data
+  int retries;
+} sd;
+
+// Ask the firmware's property mailbox for tag,
+// with two words of data. Returns the second word
+// of the reply, or 0 if the request failed.
+static u_int32
+sdmailbox(u_int32 tag, u_int32 id, u_int32 val)
+{
+  extern volatile u_int32 *mail_buffer;
+  u_int32 data[2];
+
+  data[0] = id;
+  data[1] = val;
+  create_request(mail_buffer, tag, 8, 8, data);
+  writemailbox((u_int32*)mail_buffer, 8);
+  readmailbox(8);
+  if(mail_buffer[POS_RV] != MPI_RESPONSE_OK)
+    return 0;
+  return mail_buffer[MB_HEADER_LENGTH + TAG_HEADER_LENGTH + 1];
+}
+
+// Wait up to us microseconds for the bits of
+// register reg in mask to become want.
+static int
+sdpoll(u_int32 reg, u_int32 mask, u_int32 want, u_int32 us)
+{
+  unsigned long long t;
+
+  t = getsystemtime() + us;
+  while((inw(EMMC_BASE+reg) & mask) != want)
+    if(getsystemtime() > t)
+      return -1;
+  return 0;
+}
+
+// Reset the controller's command and/or data circuits
+// (C1_SRST_CMD, C1_SRST_DATA) after an error.
+static void
+sdresetlines(u_int32 lines)
+{
+  outw(EMMC_BASE+EMMC_CONTROL1, inw(EMMC_BASE+EMMC_CONTROL1) | lines);
+  if(sdpoll(EMMC_CONTROL1, lines, 0, SD_TIMEOUT) < 0)
+    panic("sdresetlines");
+}
+
+// Run the SD clock at no more than hz.
+static void
+sdclock(u_int32 hz)
+{
+  u_int32 d, c1;
+
+  // The SD clock is the base clock / (2*d), with a 10-bit d.
+  d = udiv(sd.baseclk + 2*hz - 1, 2*hz);
+  if(d > 0x3FF)
+    d = 0x3FF;
+  c1 = C1_CLK_INTLEN | C1_TOUNIT_MAX | (d & 0xFF) << 8 | (d >> 8) << 6;
+  outw(EMMC_BASE+EMMC_CONTROL1, inw(EMMC_BASE+EMMC_CONTROL1) & ~C1_CLK_EN);
+  outw(EMMC_BASE+EMMC_CONTROL1, c1);
+  if(sdpoll(EMMC_CONTROL1, C1_CLK_STABLE, C1_CLK_STABLE, SD_TIMEOUT) < 0)
+    panic("sdclock");
+  outw(EMMC_BASE+EMMC_CONTROL1, c1 | C1_CLK_EN);
+  delay(2000);
+}
+
+// Send a command without data, polling for its response,
+// which is left in EMMC_RESP0. Only used by ideinit(),
+// before the controller's interrupt is enabled.
+static int
+sdcmd(u_int32 cmd, u_int32 arg)
+{
+  unsigned long long t;
+  u_int32 intr;
+
+  if(sdpoll(EMMC_STATUS, SR_CMD_INHIBIT, 0, SD_TIMEOUT) < 0)
+    return -1;
+  outw(EMMC_BASE+EMMC_INTERRUPT, 0xFFFFFFFF);
+  outw(EMMC_BASE+EMMC_ARG1, arg);
+  outw(EMMC_BASE+EMMC_CMDTM, cmd);
+  t = getsystemtime() + SD_TIMEOUT;
+  while(!((intr = inw(EMMC_BASE+EMMC_INTERRUPT)) & (INT_CMD_DONE|INT_ERR)))
+    if(getsystemtime() > t)
+      break;
+  if((intr & (INT_CMD_DONE|INT_ERR)) != INT_CMD_DONE){
+    outw(EMMC_BASE+EMMC_INTERRUPT, intr);
+    sdresetlines(C1_SRST_CMD);
+    return -1;
+  }
+  // A busy response ends when the card releases the data line.
+  if((cmd & CMD_RSPNS_48B) == CMD_RSPNS_48B)
+    sdpoll(EMMC_INTERRUPT, INT_DATA_DONE, INT_DATA_DONE, SD_TIMEOUT);
+  outw(EMMC_BASE+EMMC_INTERRUPT, 0xFFFFFFFF);
+  return 0;
+}
+
+// Send an application-specific command.
+static int
+sdacmd(u_int32 cmd, u_int32 arg)
+{
+  if(sdcmd(SD_APP_CMD, sd.rca) < 0)
+    return -1;
+  return sdcmd(cmd, arg);
+}
+
+void
+ideinit(void)
+{
+  int_ctrl_regs *ip;
+  u_int32 ocr;
+  int i, v2;
+
+  initlock(&idelock, "ide");
+
+  if((sdmailbox(MPI_TAG_SET_POWER_STATE, 0, 3) & 3) != 1)
+    cprintf("ideinit: SD card power on failed\n");
+  if((sd.baseclk = sdmailbox(MPI_TAG_GET_CLOCK_RATE, 1, 0)) == 0)
+    sd.baseclk = 100000000;
+
+  outw(EMMC_BASE+EMMC_CONTROL1, C1_SRST_HC);
+  if(sdpoll(EMMC_CONTROL1, C1_SRST_HC, 0, SD_TIMEOUT) < 0)
+    panic("ideinit: EMMC reset");
+  outw(EMMC_BASE+EMMC_CONTROL0, C0_BUS_POWER);
+  sdclock(400000);
+  outw(EMMC_BASE+EMMC_IRPT_EN, 0);
+  outw(EMMC_BASE+EMMC_IRPT_MASK, 0xFFFFFFFF);
+
+  // Identify the card, and move it to the transfer state.
+  sdcmd(SD_GO_IDLE, 0);
+  v2 = sdcmd(SD_SEND_IF_COND, 0x1AA) == 0 &&
+       (inw(EMMC_BASE+EMMC_RESP0) & 0xFFF) == 0x1AA;
+  for(i = 0; ; i++){
+    if(sdacmd(SD_SEND_OP_COND, 0x00FF8000 | (v2 ? 1<<30 : 0)) < 0)
+      panic("ideinit: no SD card");
+    ocr = inw(EMMC_BASE+EMMC_RESP0);
+    if(ocr & 0x80000000)
+      break;
+    if(i == 1000)
+      panic("ideinit: SD card not ready");
+    delay(1000);
+  }
+  sd.sdhc = (ocr & (1<<30)) != 0;
+  if(sdcmd(SD_ALL_SEND_CID, 0) < 0 || sdcmd(SD_SEND_RCA, 0) < 0)
+    panic("ideinit: SD card identify");
+  sd.rca = inw(EMMC_BASE+EMMC_RESP0) & 0xFFFF0000;
+  sdclock(25000000);
+  if(sdcmd(SD_SELECT, sd.rca) < 0)
+    panic("ideinit: SD card select");
+  if(!sd.sdhc && sdcmd(SD_SET_BLOCKLEN, SDBLK) < 0)
+    panic("ideinit: SD card block length");
+  if(sdacmd(SD_SET_BUS_WIDTH, 2) == 0)
+    outw(EMMC_BASE+EMMC_CONTROL0, C0_BUS_POWER | C0_HCTL_DWIDTH);
+
+  outw(EMMC_BASE+EMMC_IRPT_EN,
+       INT_DATA_DONE | INT_READ_RDY | INT_WRITE_RDY | INT_ERRORS);
+  ip = (int_ctrl_regs *)INT_REGS_BASE;
+  ip->irq_enable[1] |= 1 << IRQ_EMMC_BIT;
+  cprintf("ideinit: %s card, rca %x\n", sd.sdhc ? "SDHC" : "SDSC", sd.rca >> 16);
+}
+
+// Start the transfer at the head of idequeue, along with
+// the buffers queued behind it which continue it on disk.
+// Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf *b, *p;
+  u_int32 blk, cmd;
+  int n, write;
+
+  b = idequeue;
+  write = (b->flags & B_DIRTY) != 0;
+  for(p = b, n = 1; n < SD_MAXRUN && p->qnext; p = p->qnext, n++)
+    if(p->qnext->sector != p->sector + 1 ||
+       ((p->qnext->flags & B_DIRTY) != 0) != write)
+      break;
+
+  sd.nbuf = n;
+  sd.cur = b;
+  sd.off = 0;
+  blk = SD_FSSTART + b->sector * SPB;
+  if(!sd.sdhc)
+    blk *= SDBLK;
+  if(n * SPB == 1)
+    cmd = write ? SD_WRITE_ONE : SD_READ_ONE;
+  else
+    cmd = write ? SD_WRITE_MULTI : SD_READ_MULTI;
+
+  if(sdpoll(EMMC_STATUS, SR_CMD_INHIBIT|SR_DAT_INHIBIT, 0, SD_TIMEOUT) < 0)
+    sdresetlines(C1_SRST_CMD|C1_SRST_DATA);
+  outw(EMMC_BASE+EMMC_BLKSIZECNT, (n * SPB) << 16 | SDBLK);
+  outw(EMMC_BASE+EMMC_ARG1, blk);
+  outw(EMMC_BASE+EMMC_CMDTM, cmd);
+}
+
+// Move the next card block of the transfer
+// through the data port.
+static void
+idepio(void)
+{
+  u_int32 *p;
+  int i;
+
+  p = (u_int32*)(sd.cur->data + sd.off);
+  if(sd.cur->flags & B_DIRTY)
+    for(i = 0; i < SDBLK/4; i++)
+      outw(EMMC_BASE+EMMC_DATA, p[i]);
+  else
+    for(i = 0; i < SDBLK/4; i++)
+      p[i] = inw(EMMC_BASE+EMMC_DATA);
+  if((sd.off += SDBLK) == BSIZE){
+    sd.off = 0;
+    sd.cur = sd.cur->qnext;
+  }
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct buf *b, *done;
+  u_int32 intr;
+  int i, err;
+
+  acquire(&idelock);
+  intr = inw(EMMC_BASE+EMMC_INTERRUPT);
+  outw(EMMC_BASE+EMMC_INTERRUPT, intr);
+  if(sd.nbuf == 0){
+    release(&idelock);
+    return;
+  }
+
+  err = 0;
+  if(intr & INT_ERR){
+    cprintf("ideintr: error %x at sector %d\n", intr, idequeue->sector);
+    sdresetlines(C1_SRST_CMD|C1_SRST_DATA);
+    if(++sd.retries <= SD_RETRIES){
+      idestart();
+      release(&idelock);
+      return;
+    }
+    err = 1;
+  } else {
+    if((intr & (INT_READ_RDY|INT_WRITE_RDY)) && sd.cur)
+      idepio();
+    if(!(intr & INT_DATA_DONE)){
+      release(&idelock);
+      return;
+    }
+  }
+
+  // The transfer is done, or has failed SD_RETRIES times:
+  // take its buffers off the queue, marking them B_ERROR if
+  // it failed. Waiters are woken, and bread() or bwrite()
+  // decides what a failure means. Read-ahead buffers, which
+  // have no waiter, are released once idelock is dropped;
+  // a failed one is just left not B_VALID.
+  done = 0;
+  for(i = 0; i < sd.nbuf; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(err)
+      b->flags |= B_ERROR;
+    else {
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+    }
+    if(b->flags & B_ASYNC){
+      b->flags &= ~(B_ASYNC|B_ERROR);
+      b->qnext = done;
+      done = b;
+    } else
+      wakeup(b);
+  }
+  sd.nbuf = 0;
+  sd.retries = 0;
+  if(idequeue)
+    idestart();
+  release(&idelock);
+
+  while((b = done) != 0){
+    done = b->qnext;
+    brelse(b);
+  }
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If the transfer fails, set B_ERROR instead.
+// If B_ASYNC is set, return at once; the interrupt
+// handler releases buf when the transfer is done.
+void
+iderw(struct buf *b)
+{
+  struct buf **pp;
+
+  if(!(b->flags & B_BUSY))
+    panic("iderw: buf not busy");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+
+  acquire(&idelock);
+  b->flags &= ~B_ERROR;
+
+  // Append b to idequeue.
+  b->qnext = 0;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+    ;
+  *pp = b;
+
+  // Start disk if necessary.
+  if(idequeue == b)
+    idestart();
+
+  // Wait for request to finish.
+  if(!(b->flags & B_ASYNC))
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID && !(b->flags & B_ERROR))
+      sleep(b, &idelock);
+
+  release(&idelock);
+}
+
+#endif
@@ -11,11 +11,12 @@ int
 exec(char *path, char **argv)
 {
   char *last;
-  int i, off;
+  int i, off, nseg;
   u_int32 argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *oldexe;
   struct proghdr ph;
+  struct vmseg seg[NSEG];
   pde_t *pgdir, *oldpgdir;
 
   if((ip = namei(path)) == 0)
@@ -31,22 +32,26 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
-  // Load program into memory.
+  // Reserve memory for the program. Its pages are read from
+  // ip, or zeroed, by pagefault() when they are first touched.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
     if(ph.type != ELF_PROG_LOAD)
       continue;
-    if(ph.memsz < ph.filesz)
+    if(ph.memsz < ph.filesz || nseg == NSEG)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= USERBOUND)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
-  ip = 0;
 
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible.  Use the second as the user stack.
@@ -83,7 +88,17 @@ exec(char *path, char **argv)
   last = argv[0];
   safestrcpy(curr_proc->name, last, sizeof(curr_proc->name));
 
+  // Text pages are read from ip on demand; keep it
+  // from being written while this image runs.
+  if(idenywrite(ip) < 0)
+    goto bad;
+
   // Commit to the user image.
+  iunlock(ip);
+  oldexe = curr_proc->exe;
+  curr_proc->exe = ip;
+  memmove(curr_proc->seg, seg, sizeof(seg));
+  curr_proc->nseg = nseg;
   oldpgdir = curr_proc->pgdir;
   curr_proc->pgdir = pgdir;
   curr_proc->sz = sz;
@@ -92,7 +107,12 @@ exec(char *path, char **argv)
   curr_proc->tf->r0 = ustack[1];
   curr_proc->tf->r1 = ustack[2];
   switchuvm(curr_proc);
+  flushuvm(curr_proc);  // drop the old image's TLB entries
   freevm(oldpgdir);
+  if(oldexe){
+    iallowwrite(oldexe);
+    iput(oldexe);
+  }
   return 0;
 
  bad:
@@ -73,6 +73,8 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
+    if(ff.writable)
+      iputwrite(ff.ip);
     begin_trans();
     iput(ff.ip);
     commit_trans();
@@ -105,8 +107,10 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     ilock(f->ip);
 //cprintf("inside fileread\n");
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      ireadahead(f->ip, &f->ra, f->off, r);
       f->off += r;
+    }
 //cprintf("inside fileread: after readi rv=%x\n", r);
     iunlock(f->ip);
     return r;
@@ -128,25 +132,27 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks at a time as the log space
+    // the transaction reserves allows for, including
+    // i-node, double-indirect and indirect blocks,
+    // allocation blocks, and 2 blocks of slop for
+    // non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
     int i = 0;
     while(i < n){
       int n1 = n - i;
+      int nb = (n1 > LOGSIZE*BSIZE ? LOGSIZE : (n1 + BSIZE - 1) / BSIZE);
+      int res = begin_ntrans(1 + 2 + 2 + 2*nb);
+      int max = ((res-1-2-2) / 2) * BSIZE;
       if(n1 > max)
         n1 = max;
 
-      begin_trans();
       ilock(f->ip);
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      commit_trans();
+      commit_ntrans(res);
 
       if(r < 0)
         break;
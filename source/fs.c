@@ -19,21 +19,69 @@
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "kstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(u_int32, u_int32);
+
+// In-core state of the mounted file system: a copy of its
+// superblock, and a summary of its free block bitmap, with
+// the number of free blocks each bitmap block describes and
+// a next-fit cursor, so that balloc() need not scan the
+// bitmap from the start.  Set up by fsinit().
+static struct {
+  struct spinlock lock;
+  u_int32 dev;          // device, or 0 before fsinit()
+  struct superblock sb;
+  u_int32 nbmap;        // bitmap blocks
+  u_int32 *nfree;       // free blocks in each bitmap block
+  u_int32 cursor;       // where the next search starts
+} fsi;
 
 // Read the super block.
 void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
-  
+
+  if(fsi.dev == dev){
+    memmove(sb, &fsi.sb, sizeof(*sb));
+    return;
+  }
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
 }
 
+// Cache the superblock of dev and count its free blocks.
+// Called once, by the first process, after initlog() has
+// recovered the file system.
+void
+fsinit(int dev)
+{
+  struct buf *bp;
+  u_int32 bb, bi, n;
+
+  initlock(&fsi.lock, "fsi");
+  readsb(dev, &fsi.sb);
+  fsi.nbmap = (fsi.sb.size + BPB - 1) / BPB;
+  if(fsi.nbmap > PGSIZE / sizeof(fsi.nfree[0]) || (fsi.nfree = (u_int32*)kalloc()) == 0)
+    panic("fsinit: bitmap summary");
+  for(bb = 0; bb < fsi.nbmap; bb++){
+    bp = bread(dev, BBLOCK(bb*BPB, fsi.sb.ninodes));
+    n = 0;
+    for(bi = 0; bi < BPB && bb*BPB + bi < fsi.sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        n++;
+    brelse(bp);
+    fsi.nfree[bb] = n;
+  }
+  fsi.cursor = 0;
+  fsi.dev = dev;
+}
+
 // Zero a block.
 static void
 bzero(int dev, int bno)
@@ -48,29 +96,81 @@ bzero(int dev, int bno)
 
 // Blocks. 
 
-// Allocate a zeroed disk block.
+#define BRUN 8  // free run new files start in, to grow into
+
+// Is bit bi of bitmap block data clear?
+#define BFREE(data, bi) (((data)[(bi)/8] & (1 << ((bi) % 8))) == 0)
+
+// Search bitmap block bb, from bit lo up to bit hi, for a
+// free block followed by at least run-1 more free blocks
+// in the same bitmap block.  Mark the block in use and
+// return its number, or return 0 if there is none.
 static u_int32
-balloc(u_int32 dev)
+bscan(u_int32 dev, u_int32 bb, u_int32 lo, u_int32 hi, u_int32 run)
 {
-  int b, bi, m;
   struct buf *bp;
-  struct superblock sb;
+  u_int32 bi, end, k;
 
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  end = min(BPB, fsi.sb.size - bb*BPB);
+  hi = min(hi, end);
+  bp = bread(dev, BBLOCK(bb*BPB, fsi.sb.ninodes));
+  for(bi = lo; bi < hi; bi++){
+    if(!BFREE(bp->data, bi))
+      continue;
+    for(k = 1; k < run && bi + k < end && BFREE(bp->data, bi + k); k++)
+      ;
+    if(k < run)
+      continue;
+    bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+    log_write(bp);
+    brelse(bp);
+    acquire(&fsi.lock);
+    fsi.nfree[bb]--;
+    release(&fsi.lock);
+    return bb*BPB + bi;
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a disk block, which is not zeroed.
+// If goal is not 0 and is free, allocate goal, so that a
+// growing file extends its last run of blocks.  Otherwise
+// search onwards from the cursor for the start of a free run
+// of BRUN blocks, and move the cursor past the run, so that
+// the file can grow into it; failing that, take any free block.
+static u_int32
+balloc(u_int32 dev, u_int32 goal)
+{
+  u_int32 b, bb, i, run;
+
+  if(goal > 0 && goal < fsi.sb.size && fsi.nfree[goal/BPB] > 0 &&
+     (b = bscan(dev, goal/BPB, goal%BPB, goal%BPB + 1, 1)) != 0)
+    return b;
+
+  for(run = BRUN; ; run = 1){
+    // Visit the cursor's bitmap block twice: from the
+    // cursor first, and from its start last.
+    for(i = 0; i <= fsi.nbmap; i++){
+      // The wraps compare and subtract, rather than divide:
+      // the cores without UDIV would need a libgcc routine.
+      bb = fsi.cursor/BPB + i;
+      if(bb >= fsi.nbmap)
+        bb -= fsi.nbmap;
+      if(fsi.nfree[bb] < run)
+        continue;
+      b = bscan(dev, bb, i == 0 ? fsi.cursor%BPB : 0, BPB, run);
+      if(b != 0){
+        acquire(&fsi.lock);
+        fsi.cursor = b + run;
+        if(fsi.cursor >= fsi.sb.size)
+          fsi.cursor -= fsi.sb.size;
+        release(&fsi.lock);
+        return b;
       }
     }
-    brelse(bp);
+    if(run == 1)
+      break;
   }
   panic("balloc: out of blocks");
   return -1;
@@ -81,11 +181,9 @@ static void
 bfree(int dev, u_int32 b)
 {
   struct buf *bp;
-  struct superblock sb;
   int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  bp = bread(dev, BBLOCK(b, fsi.sb.ninodes));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -93,6 +191,9 @@ bfree(int dev, u_int32 b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&fsi.lock);
+  fsi.nfree[b/BPB]++;
+  release(&fsi.lock);
 }
 
 // Inodes.
@@ -120,18 +221,20 @@ bfree(int dev, u_int32 b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
-//   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() to find or create a
+//   cache entry and increment its ref, iput() to
+//   decrement ref. An entry whose ref is zero stays
+//   cached, on an LRU list, until iget() recycles it
+//   for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when the I_VALID bit
 //   is set in ip->flags. ilock() reads the inode from
-//   the disk and sets I_VALID, while iput() clears
-//   I_VALID if ip->ref has fallen to zero.
+//   the disk and sets I_VALID, while iget() clears
+//   I_VALID when it recycles the entry. iget() of an
+//   inode still cached and valid needs no disk read.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -157,16 +260,141 @@ bfree(int dev, u_int32 b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+//
+// The inode cache is sized at boot from the amount of physical
+// memory. Cached inodes are hashed on (dev, inum) into NIHASH
+// chains. When iget() needs an entry for an uncached inode it
+// takes a never-used one, or else recycles the least recently
+// released unreferenced one; only if every entry is referenced
+// does it allocate another page of entries.
+
+#define NIHASH     257  // hash chains (prime)
+#define ICACHE_RAM 1024 // use 1/ICACHE_RAM of memory for inodes
+#define MAXINODE  4096  // upper bound on the boot-time size
+
+extern unsigned int pm_size;
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  int ninode;
+  struct inode *hash[NIHASH];
+  struct inode *unused;  // never-used entries, through next
+  struct inode lru;      // lru.next is the most recently released
+  u_int32 hits;
+  u_int32 misses;
+  u_int32 evicts;
 } icache;
 
+// Add a page of never-used entries to the inode cache.
+// Returns the number added. Caller holds icache.lock,
+// unless it is iinit().
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *page;
+  int i;
+
+  if((page = kalloc()) == 0)
+    return 0;
+  memset(page, 0, PGSIZE);
+  for(i = 0; i < PGSIZE / sizeof(struct inode); i++){
+    ip = (struct inode*)page + i;
+    ip->next = icache.unused;
+    icache.unused = ip;
+  }
+  icache.ninode += i;
+  return i;
+}
+
+// Allocate the inode cache. Called after kinit2(),
+// once the size of physical memory is known.
 void
 iinit(void)
 {
+  int n;
+
   memset(&icache, 0, sizeof(icache));
   initlock(&icache.lock, "icache");
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+
+  n = pm_size / ICACHE_RAM / sizeof(struct inode);
+  if(n < NINODE)
+    n = NINODE;
+  if(n > MAXINODE)
+    n = MAXINODE;
+  while(icache.ninode < n)
+    if(igrow() == 0)
+      break;
+  if(icache.ninode < NINODE)
+    panic("iinit: no memory");
+  cprintf("iinit: %d inodes\n", icache.ninode);
+  dcinit();
+}
+
+static struct inode**
+ihash(u_int32 dev, u_int32 inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Take ip, whose ref is zero, off the LRU list.
+// Caller holds icache.lock.
+static void
+ilruunlink(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+}
+
+// Put ip, whose ref has fallen to zero, on the LRU list:
+// at the front if it is still worth caching, else at the
+// back, to be recycled first. Caller holds icache.lock.
+static void
+ilrupush(struct inode *ip, int keep)
+{
+  struct inode *at;
+
+  at = keep ? &icache.lru : icache.lru.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+// Remove ip from its hash chain. Caller holds icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+}
+
+// Copy up to n bytes of inode cache statistics,
+// as a struct icachestat, into dst.
+// Returns the number of bytes copied.
+int
+icachestat(char *dst, int n)
+{
+  struct icachestat st;
+
+  acquire(&icache.lock);
+  st.ninode = icache.ninode;
+  st.hits = icache.hits;
+  st.misses = icache.misses;
+  st.evicts = icache.evicts;
+  release(&icache.lock);
+  if(n > sizeof(st))
+    n = sizeof(st);
+  memmove(dst, &st, n);
+  return n;
 }
 
 static struct inode* iget(u_int32 dev, u_int32 inum);
@@ -225,31 +453,43 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(u_int32 dev, u_int32 inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = *ihash(dev, inum); ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref == 0)
+        ilruunlink(ip);
       ip->ref++;
+      icache.hits++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
+  icache.misses++;
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Use a never-used entry, or recycle the least recently
+  // released one, or failing both grow the cache.
+  if(icache.unused == 0 && icache.lru.prev == &icache.lru && igrow() == 0)
     panic("iget: no inodes");
+  if((ip = icache.unused) != 0){
+    icache.unused = ip->next;
+  } else {
+    ip = icache.lru.prev;
+    ilruunlink(ip);
+    iunhash(ip);
+    icache.evicts++;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->bhint = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&icache.lock);
 
   return ip;
@@ -266,6 +506,62 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Text pages of a running program are read from its inode
+// on demand, so the inode must not change while some
+// process runs it. exec and fork count each p->exe with
+// idenywrite(), and every writable open with igetwrite();
+// each fails while the other count is non-zero.
+
+// Count a process running ip. Returns -1 if ip is open
+// for writing.
+int
+idenywrite(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->nwrite > 0){
+    release(&icache.lock);
+    return -1;
+  }
+  ip->nexec++;
+  release(&icache.lock);
+  return 0;
+}
+
+void
+iallowwrite(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->nexec < 1)
+    panic("iallowwrite");
+  ip->nexec--;
+  release(&icache.lock);
+}
+
+// Count a writable open of ip. Returns -1 if a process
+// is running ip.
+int
+igetwrite(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->nexec > 0){
+    release(&icache.lock);
+    return -1;
+  }
+  ip->nwrite++;
+  release(&icache.lock);
+  return 0;
+}
+
+void
+iputwrite(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->nwrite < 1)
+    panic("iputwrite");
+  ip->nwrite--;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -314,7 +610,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, least recently released first.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 void
@@ -327,6 +623,8 @@ iput(struct inode *ip)
       panic("iput busy");
     ip->flags |= I_BUSY;
     release(&icache.lock);
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -334,7 +632,8 @@ iput(struct inode *ip)
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilrupush(ip, ip->flags & I_VALID);
   release(&icache.lock);
 }
 
@@ -352,19 +651,71 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT blocks
+// after those are listed in the NINDIRECT indirect blocks
+// which are themselves listed in block ip->addrs[NDIRECT+1].
+
+// Return the number of entries from a[i] on, at most max and
+// not past a[n-1], that hold consecutive disk block addresses.
+static u_int32
+brun(u_int32 *a, u_int32 i, u_int32 n, u_int32 max)
+{
+  u_int32 k;
+
+  for(k = 1; k < max && i + k < n; k++)
+    if(a[i + k] != a[i] + k)
+      break;
+  return k;
+}
+
+// Allocate a block for inode ip, just after the block last
+// allocated for it if that is free.  Blocks of addresses
+// are zeroed; data blocks need not be, as writei() writes
+// them before the file's size covers any of their bytes.
+static u_int32
+iballoc(struct inode *ip, int zero)
+{
+  u_int32 b;
+
+  b = balloc(ip->dev, ip->bhint);
+  ip->bhint = b + 1;
+  if(zero)
+    bzero(ip->dev, b);
+  return b;
+}
+
+// Return the entry a[i] of the block of addresses in bp,
+// allocating a block for it, for inode ip, if it is 0.
+static u_int32
+baddr(struct inode *ip, struct buf *bp, u_int32 i, int zero)
+{
+  u_int32 *a, addr;
+
+  a = (u_int32*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = iballoc(ip, zero);
+    log_write(bp);
+  }
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// If prun is not 0, also set *prun to the number of blocks,
+// at most max, from the nth on which are stored one after
+// another on disk, as far as one block of addresses shows;
+// so a sequential reader need only map each run once.
 static u_int32
-bmap(struct inode *ip, u_int32 bn)
+bmaprun(struct inode *ip, u_int32 bn, u_int32 max, u_int32 *prun)
 {
-  u_int32 addr, *a;
+  u_int32 addr;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip, 0);
+    if(prun)
+      *prun = brun(ip->addrs, bn, NDIRECT, max);
     return addr;
   }
   bn -= NDIRECT;
@@ -372,19 +723,54 @@ bmap(struct inode *ip, u_int32 bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = iballoc(ip, 1);
+  } else if((bn -= NINDIRECT) < NDINDIRECT){
+    // Load the double-indirect block, and from it
+    // the indirect block, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = iballoc(ip, 1);
     bp = bread(ip->dev, addr);
-    a = (u_int32*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
+    addr = baddr(ip, bp, bn / NINDIRECT, 1);
     brelse(bp);
-    return addr;
-  }
+    bn %= NINDIRECT;
+  } else
+    panic("bmap: out of range");
+
+  bp = bread(ip->dev, addr);
+  addr = baddr(ip, bp, bn, 0);
+  if(prun)
+    *prun = brun((u_int32*)bp->data, bn, NINDIRECT, max);
+  brelse(bp);
+  return addr;
+}
 
-  panic("bmap: out of range");
-  return -1;
+static u_int32
+bmap(struct inode *ip, u_int32 bn)
+{
+  return bmaprun(ip, bn, 1, 0);
+}
+
+// Free the blocks listed in the block of addresses addr, and
+// with depth 1, the blocks listed in those; then free addr.
+static void
+bfreeall(int dev, u_int32 addr, int depth)
+{
+  struct buf *bp;
+  u_int32 *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (u_int32*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      bfreeall(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -395,9 +781,7 @@ bmap(struct inode *ip, u_int32 bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  u_int32 *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -407,21 +791,56 @@ itrunc(struct inode *ip)
   }
   
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (u_int32*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeall(ip->dev, ip->addrs[NDIRECT], 0);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    bfreeall(ip->dev, ip->addrs[NDIRECT+1], 1);
+    ip->addrs[NDIRECT+1] = 0;
+  }
 
   ip->size = 0;
   iupdate(ip);
 }
 
+#define RAMIN  4  // first readahead window, in blocks
+#define RAMAX 32  // largest readahead window, in blocks
+
+// Note a read of n bytes at offset off of inode ip, which
+// must be locked, by a reader with readahead state ra.
+// If the read follows on from the reader's last one, start
+// reading the next ra->win blocks of the file into the
+// buffer cache without waiting for them, doubling the window
+// with each sequential read, up to RAMAX blocks.
+// Any other read closes the window.
+void
+ireadahead(struct inode *ip, struct rastate *ra, u_int32 off, u_int32 n)
+{
+  u_int32 b, end, addr, run, i;
+
+  if(ip->type == T_DEV)
+    return;
+  if(off != ra->next){
+    ra->next = off + n;
+    ra->win = 0;
+    ra->end = 0;
+    return;
+  }
+  ra->next = off + n;
+  ra->win = ra->win ? min(2 * ra->win, RAMAX) : RAMIN;
+  // Blocks from the first not yet read or read ahead,
+  // up to the window's end or the end of the file.
+  b = (ra->end > off + n ? ra->end : off + n + BSIZE-1) / BSIZE;
+  end = (min(off + n + ra->win*BSIZE, ip->size) + BSIZE-1) / BSIZE;
+  for(; b < end; b += run){
+    addr = bmaprun(ip, b, end - b, &run);
+    for(i = 0; i < run; i++)
+      breadahead(ip->dev, addr + i);
+  }
+  if(end * BSIZE > ra->end)
+    ra->end = end * BSIZE;
+}
+
 // Copy stat information from inode.
 void
 stati(struct inode *ip, struct stat *st)
@@ -438,7 +857,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, u_int32 off, u_int32 n)
 {
-  u_int32 tot, m;
+  u_int32 tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -453,8 +872,14 @@ readi(struct inode *ip, char *dst, u_int32 off, u_int32 n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // Map each run of contiguous blocks once, then read
+  // the blocks of the run one after another.
+  run = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(run == 0)
+      addr = bmaprun(ip, off/BSIZE, (off%BSIZE + n - tot + BSIZE-1) / BSIZE, &run);
+    bp = bread(ip->dev, addr++);
+    run--;
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -506,60 +931,296 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// The dcache remembers the results of dirlookup(), keyed by
+// (dev, directory inum, name), so that path lookups need not
+// scan directory contents.  An entry with inum 0 is negative:
+// it records that the directory has no such name.
+//
+// Entries are only looked up, entered and changed while the
+// directory's inode is locked, and every change to a directory's
+// entries goes through dirlink() or sys_unlink(), which update
+// the cache.  So a cached entry always matches the directory.
+// When a directory inode is freed, iput() purges its entries,
+// before its inum can be reused.
+//
+// Entries are hashed into DCACHE_HASH chains and kept on an LRU
+// list; a new entry recycles the least recently used one.
+
+#define NDCACHE     128  // cached directory entries
+#define DCACHE_HASH  61  // hash chains (prime)
+
+struct dent {
+  u_int32 dev;
+  u_int32 dinum;        // directory; 0 if the entry is unused
+  char name[DIRSIZ];
+  u_int32 inum;         // 0 for a negative entry
+  u_int32 off;          // byte offset of the dirent in the directory
+  struct dent *hnext;   // hash chain
+  struct dent *prev;    // LRU list
+  struct dent *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct dent ent[NDCACHE];
+  struct dent *hash[DCACHE_HASH];
+  struct dent lru;      // lru.next is the most recently used
+  u_int32 hits;
+  u_int32 neghits;
+  u_int32 misses;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dent *e;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(e = dcache.ent; e < dcache.ent + NDCACHE; e++){
+    e->next = dcache.lru.next;
+    e->prev = &dcache.lru;
+    dcache.lru.next->prev = e;
+    dcache.lru.next = e;
+  }
+}
+
+static struct dent**
+dchash(u_int32 dev, u_int32 dinum, char *name)
+{
+  u_int32 h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (u_char8)name[i];
+  return &dcache.hash[h % DCACHE_HASH];
+}
+
+// Move e to the front of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dctouch(struct dent *e)
+{
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  e->next = dcache.lru.next;
+  e->prev = &dcache.lru;
+  dcache.lru.next->prev = e;
+  dcache.lru.next = e;
+}
+
+// Find the entry for name in directory (dev, dinum),
+// and make it the most recently used.
+// Caller must hold dcache.lock.
+static struct dent*
+dcfind(u_int32 dev, u_int32 dinum, char *name)
+{
+  struct dent *e;
+
+  for(e = *dchash(dev, dinum, name); e; e = e->hnext){
+    if(e->dev == dev && e->dinum == dinum && namecmp(e->name, name) == 0){
+      dctouch(e);
+      return e;
+    }
+  }
+  return 0;
+}
+
+// Remove e from its hash chain, leaving it unused.
+// Caller must hold dcache.lock.
+static void
+dcunhash(struct dent *e)
+{
+  struct dent **pp;
+
+  for(pp = dchash(e->dev, e->dinum, e->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == e){
+      *pp = e->hnext;
+      break;
+    }
+  }
+  e->dinum = 0;
+}
+
+// Look up name in the cached entries of directory dp.
+// Returns 1 and sets *pinum and *poff if the entry is
+// cached (*pinum is 0 if the name is known to be absent).
+// Returns 0 if it is not cached.
+static int
+dclookup(struct inode *dp, char *name, u_int32 *pinum, u_int32 *poff)
+{
+  struct dent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  if(e->inum)
+    dcache.hits++;
+  else
+    dcache.neghits++;
+  *pinum = e->inum;
+  *poff = e->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inode inum,
+// in the dirent at byte offset off, or is absent if inum is 0.
+static void
+dcenter(struct inode *dp, char *name, u_int32 inum, u_int32 off)
+{
+  struct dent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    e = dcache.lru.prev;
+    if(e->dinum)
+      dcunhash(e);
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    e->hnext = *dchash(e->dev, e->dinum, e->name);
+    *dchash(e->dev, e->dinum, e->name) = e;
+    dctouch(e);
+  }
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Record that name has been removed from directory dp.
+// Caller must hold dp locked.
+void
+dcunlink(struct inode *dp, char *name)
+{
+  dcenter(dp, name, 0, 0);
+}
+
+// Drop every cached entry of directory (dev, dinum),
+// which is being freed.
+static void
+dcpurge(u_int32 dev, u_int32 dinum)
+{
+  struct dent *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < dcache.ent + NDCACHE; e++)
+    if(e->dinum == dinum && e->dev == dev)
+      dcunhash(e);
+  release(&dcache.lock);
+}
+
+// Copy up to n bytes of directory cache statistics,
+// as a struct dcachestat, into dst.
+// Returns the number of bytes copied.
+int
+dcachestat(char *dst, int n)
+{
+  struct dcachestat st;
+
+  acquire(&dcache.lock);
+  st.nent = NDCACHE;
+  st.hits = dcache.hits;
+  st.neghits = dcache.neghits;
+  st.misses = dcache.misses;
+  release(&dcache.lock);
+  if(n > sizeof(st))
+    n = sizeof(st);
+  memmove(dst, &st, n);
+  return n;
+}
+
+// Scan the entries of directory dp for name, reading each
+// block of the directory once and examining its entries in
+// the buffer.  If found, set *pinum and return the byte offset
+// of the entry; otherwise return -1.  If pfree is not 0, also
+// set *pfree to the offset of the first empty entry, or to
+// dp->size if there is none.
+static int
+dirscan(struct inode *dp, char *name, u_int32 *pinum, u_int32 *pfree)
+{
+  u_int32 off, n;
+  struct buf *bp;
+  struct dirent *de, *end;
+  int found;
+
+  if(pfree)
+    *pfree = dp->size;
+  found = -1;
+  for(off = 0; off < dp->size && found < 0; off += n){
+    n = min(dp->size - off, BSIZE);
+    bp = bread(dp->dev, bmap(dp, off/BSIZE));
+    end = (struct dirent*)(bp->data + n);
+    for(de = (struct dirent*)bp->data; de < end; de++){
+      if(de->inum == 0){
+        if(pfree && *pfree == dp->size)
+          *pfree = off + (char*)de - (char*)bp->data;
+        continue;
+      }
+      if(namecmp(name, de->name) == 0){
+        *pinum = de->inum;
+        found = off + (char*)de - (char*)bp->data;
+        break;
+      }
+    }
+    brelse(bp);
+  }
+  return found;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// The result is cached in the dcache, whether found or not.
 struct inode*
 dirlookup(struct inode *dp, char *name, u_int32 *poff)
 {
   u_int32 off, inum;
-  struct dirent de;
+  int r;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(!dclookup(dp, name, &inum, &off)){
+    if((r = dirscan(dp, name, &inum, 0)) < 0)
+      inum = off = 0;
+    else
+      off = r;
+    dcenter(dp, name, inum, off);
   }
-
-  return 0;
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, u_int32 inum)
 {
-  int off;
+  u_int32 off, i;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  // Check that name is not present, and find an empty
+  // dirent, in one pass over the directory.
+  if(dclookup(dp, name, &i, &off) && i != 0)
+    return -1;
+  if(dirscan(dp, name, &i, &off) >= 0)
     return -1;
-  }
-
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum, off);
   
   return 0;
 }
@@ -1,9 +1,30 @@
+// Physical memory allocator, intended to allocate
+// memory for user processes, kernel stacks, page table pages,
+// and pipe buffers. Allocates 4096-byte pages.
+//
+// Each CPU keeps a small cache of free pages in front of the
+// global freelist, so most kalloc()/kfree() calls touch only
+// CPU-local state. Caches are refilled from, and drained to,
+// the global freelist KCACHE_BATCH pages at a time. Each CPU
+// also keeps a few pages which it zeroed while idle, and hands
+// them out through kzalloc().
+//
+// Pages shared copy-on-write after fork() carry a reference
+// count; kfree() only returns a page to the free lists when
+// its last reference is dropped.
+
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kstat.h"
+
+#define KCACHE_PAGES 32  // free pages cached per CPU
+#define KCACHE_BATCH 16  // pages moved per refill or drain
+#define KZERO_PAGES   8  // pre-zeroed pages kept per CPU
 
 void freerange(void *vstart, void *vend);
 extern char kernel_bin_end[]; // first address after kernel loaded from ELF file
@@ -17,8 +38,30 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;
 } kmem;
 
+// Per-CPU page cache. Only touched by its own CPU,
+// with interrupts disabled.
+static struct kcache {
+  int nfree;
+  char *free[KCACHE_PAGES];
+  int nzero;
+  char *zero[KZERO_PAGES];
+  u_int32 hits;
+  u_int32 misses;
+  u_int32 zeroed;
+} kcache[NCPU];
+
+// Reference counts of allocated pages, indexed by physical page
+// number. A page has count 1 from kalloc() until it is shared by
+// kdup(). The array is carved from the memory kinit2() frees, so
+// pages allocated earlier have count 0 and are never shared.
+static struct {
+  struct spinlock lock;
+  u_short16 *count;
+} kref;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,23 +74,126 @@ kinit1(void *vstart, void *vend)
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
   kmem.freelist = 0;
+  kmem.nfree = 0;
+  memset(kcache, 0, sizeof(kcache));
   freerange(vstart, vend);
 }
 
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  u_int32 n;
+
+  n = PG_ROUND_UP(pm_size / PGSIZE * sizeof(kref.count[0]));
+  kref.count = (u_short16*)PG_ROUND_UP((u_int32)vstart);
+  memset(kref.count, 0, n);
+  initlock(&kref.lock, "kref");
+  freerange((char*)kref.count + n, vend);
   kmem.use_lock = 1;
 }
 
+// Panic if v is not a page that kalloc() could have returned.
+static void
+kcheck(char *v)
+{
+  if((u_int32)v % PGSIZE || v < kernel_bin_end || v2p(v) >= pm_size)
+    panic("kfree");
+}
+
+// Push a chain of n pages from head to tail, linked
+// through run.next, onto the global freelist.
+static void
+kpush(struct run *head, struct run *tail, int n)
+{
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  tail->next = kmem.freelist;
+  kmem.freelist = head;
+  kmem.nfree += n;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Pop up to n pages from the global freelist into pages[].
+// Returns the number of pages taken.
+static int
+kpop(char **pages, int n)
+{
+  struct run *r;
+  int i;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  for(i = 0; i < n && (r = kmem.freelist) != 0; i++){
+    kmem.freelist = r->next;
+    pages[i] = (char*)r;
+  }
+  kmem.nfree -= i;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return i;
+}
+
+// Return the current CPU's page cache. Interrupts must be off.
+static struct kcache*
+mycache(void)
+{
+  return &kcache[curr_cpu - cpus];
+}
+
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
+  struct run *r;
+
   p = (char*)PG_ROUND_UP((u_int32)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kcheck(p);
+    r = (struct run*)p;
+    kpush(r, r, 1);
+  }
+}
+
+// Add a reference to page v, which must have been returned
+// by kalloc(), so that it is shared by one more owner.
+void
+kdup(char *v)
+{
+  kcheck(v);
+  acquire(&kref.lock);
+  if(kref.count[v2p(v) / PGSIZE] == 0)
+    panic("kdup");
+  kref.count[v2p(v) / PGSIZE]++;
+  release(&kref.lock);
+}
+
+// Return the number of owners of page v.
+int
+krefcnt(char *v)
+{
+  return kref.count ? kref.count[v2p(v) / PGSIZE] : 1;
+}
+
+// Drop a reference to page v. Returns the number left.
+static int
+kunref(char *v)
+{
+  u_short16 *c;
+  int n;
+
+  if(kref.count == 0)
+    return 0;
+  c = &kref.count[v2p(v) / PGSIZE];
+  // A sole owner can not race with anyone sharing the page.
+  if(*c <= 1){
+    *c = 0;
+    return 0;
+  }
+  acquire(&kref.lock);
+  n = --*c;
+  release(&kref.lock);
+  return n;
 }
 
 //PAGEBREAK: 21
@@ -55,23 +201,40 @@ freerange(void *vstart, void *vend)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared by kdup() is only freed by its last owner.
 void
 kfree(char *v)
 {
-  struct run *r;
-  if((u_int32)v % PGSIZE || v < kernel_bin_end || v2p(v) >= pm_size)
-    panic("kfree");
+  struct kcache *kc;
+  struct run *head, *r;
+  int i;
 
+  kcheck(v);
+  if(kunref(v) > 0)
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  kc = mycache();
+  if(kc->nfree == KCACHE_PAGES){
+    // Full: hand the oldest batch back to the global list.
+    head = 0;
+    for(i = KCACHE_BATCH - 1; i >= 0; i--){
+      r = (struct run*)kc->free[i];
+      r->next = head;
+      head = r;
+    }
+    kpush(head, (struct run*)kc->free[KCACHE_BATCH - 1], KCACHE_BATCH);
+    memmove(kc->free, kc->free + KCACHE_BATCH,
+            (KCACHE_PAGES - KCACHE_BATCH) * sizeof(kc->free[0]));
+    kc->nfree -= KCACHE_BATCH;
+  }
+  kc->free[kc->nfree++] = v;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -80,16 +243,109 @@ kfree(char *v)
 char*
 kalloc(void)
 {
-  struct run *r;
+  struct kcache *kc;
+  char *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  pushcli();
+  kc = mycache();
+  if(kc->nfree > 0){
+    kc->hits++;
+  } else {
+    kc->misses++;
+    kc->nfree = kpop(kc->free, KCACHE_BATCH);
+  }
+  if(kc->nfree > 0)
+    r = kc->free[--kc->nfree];
+  else if(kc->nzero > 0)
+    r = kc->zero[--kc->nzero];
+  else
+    r = 0;
+  popcli();
+  if(r && kref.count)
+    kref.count[v2p(r) / PGSIZE] = 1;
+  return r;
+}
+
+// Allocate one zeroed page, preferring a page
+// zeroed ahead of time by kzeroidle().
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  struct kcache *kc;
+  char *r;
+
+  pushcli();
+  kc = mycache();
+  r = 0;
+  if(kc->nzero > 0){
+    r = kc->zero[--kc->nzero];
+    kc->zeroed++;
+  }
+  popcli();
+  if(r == 0 && (r = kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return r;
+}
+
+// Called by an idle CPU's scheduler loop: zero one free
+// page ahead of time, if this CPU's zeroed stash has room.
+// Returns 1 if a page was zeroed, or 0 if there was nothing to do.
+int
+kzeroidle(void)
+{
+  struct kcache *kc;
+  char *r;
+  int room;
+
+  pushcli();
+  room = mycache()->nzero < KZERO_PAGES;
+  popcli();
+  if(!room || (r = kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  pushcli();
+  kc = mycache();
+  if(kc->nzero < KZERO_PAGES){
+    kc->zero[kc->nzero++] = r;
+    r = 0;
+  }
+  popcli();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+    kfree(r);
+  return 1;
 }
 
+// Return the number of free pages. The count is read
+// without locks, so it is only an estimate.
+int
+kfreepages(void)
+{
+  int i, n;
 
+  n = kmem.nfree;
+  for(i = 0; i < NCPU; i++)
+    n += kcache[i].nfree + kcache[i].nzero;
+  return n;
+}
+
+// Copy up to n bytes of per-CPU allocator statistics,
+// as an array of NCPU struct kallocstat, into dst.
+// Returns the number of bytes copied.
+int
+kallocstat(char *dst, int n)
+{
+  struct kallocstat st[NCPU];
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    st[i].hits = kcache[i].hits;
+    st[i].misses = kcache[i].misses;
+    st[i].zeroed = kcache[i].zeroed;
+    st[i].cached = kcache[i].nfree + kcache[i].nzero;
+  }
+  if(n > sizeof(st))
+    n = sizeof(st);
+  memmove(dst, st, n);
+  return n;
+}
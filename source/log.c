@@ -5,18 +5,23 @@
 #include "fs.h"
 #include "buf.h"
 
-// Simple logging. Each system call that might write the file system
-// should be surrounded with begin_trans() and commit_trans() calls.
+// Simple logging that allows concurrent FS system calls.
 //
-// The log holds at most one transaction at a time. Commit forces
-// the log (with commit record) to disk, then installs the affected
-// blocks to disk, then erases the log. begin_trans() ensures that
-// only one system call can be in a transaction; others must wait.
-// 
-// Allowing only one transaction at a time means that the file
-// system code doesn't have to worry about the possibility of
-// one transaction reading a block that another one has modified,
-// for example an i-node block.
+// A log transaction contains the updates of multiple FS system
+// calls. The logging system only commits when there are
+// no FS system calls active. Thus there is never
+// any reasoning required about whether a commit might
+// write an uncommitted system call's updates to disk.
+//
+// A system call should call begin_trans()/commit_trans() to mark
+// its start and end. Usually begin_trans() just increments
+// the count of in-progress FS system calls and returns.
+// But if it thinks the log is close to running out, it
+// sleeps until the last outstanding commit_trans() commits.
+//
+// An operation normally reserves MAXOPBLOCKS of log space.
+// A large write() reserves more, with begin_ntrans(), so that
+// it is split into few transactions.
 //
 // Read-only system calls don't need to use transactions, though
 // this means that they may observe uncommitted data. I-node and
@@ -29,39 +34,51 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The size of the log comes from the superblock. Log blocks
+// are only written at commit.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged sector #s before commit.
+// The sector array fills the rest of the header block, which
+// bounds the size of the log.
 struct logheader {
   int n;   
-  int sector[LOGSIZE];
+  int sector[BSIZE / sizeof(int) - 1];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
-  int busy; // a transaction is active
+  int size;        // data blocks in the log
+  int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by those calls.
+  int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
+static void commit(void);
 
 void
 initlog(void)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   memset(&log, 0, sizeof(log));
   initlock(&log.lock, "log");
   readsb(ROOTDEV, &sb);
+  if (sb.bsize != BSIZE)
+    panic("initlog: fs block size is not BSIZE");
   log.start = sb.size - sb.nlog;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;
+  if (log.size > NELEM(log.lh.sector))
+    log.size = NELEM(log.lh.sector);
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = ROOTDEV;
   recover_from_log();
 }
@@ -122,36 +139,122 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// called at the start of each FS system call.
 void
 begin_trans(void)
 {
+  begin_ntrans(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call which could
+// use up to n blocks of log space. Waits until at least
+// MAXOPBLOCKS are free, then reserves as many of the n
+// as are free. Returns the number of blocks reserved,
+// to be passed to commit_ntrans().
+int
+begin_ntrans(int n)
+{
+  int free;
+
+  if(n < MAXOPBLOCKS)
+    n = MAXOPBLOCKS;
   acquire(&log.lock);
-  while (log.busy) {
-    sleep(&log, &log.lock);
+  while(1){
+    free = log.size - log.lh.n - log.reserved;
+    if(log.committing){
+      sleep(&log, &log.lock);
+    } else if(free < MAXOPBLOCKS){
+      // this op might exhaust log space; wait for commit.
+      sleep(&log, &log.lock);
+    } else {
+      if(n > free)
+        n = free;
+      log.outstanding += 1;
+      log.reserved += n;
+      release(&log.lock);
+      return n;
+    }
   }
-  log.busy = 1;
-  release(&log.lock);
 }
 
+// called at the end of each FS system call.
+// commits if this was the last outstanding operation.
 void
 commit_trans(void)
+{
+  commit_ntrans(MAXOPBLOCKS);
+}
+
+// called at the end of an FS system call begun with
+// begin_ntrans(), which reserved n blocks.
+void
+commit_ntrans(int n)
+{
+  int do_commit = 0;
+
+  acquire(&log.lock);
+  log.outstanding -= 1;
+  log.reserved -= n;
+  if(log.committing)
+    panic("log.committing");
+  if(log.outstanding == 0){
+    do_commit = 1;
+    log.committing = 1;
+  } else if(n > MAXOPBLOCKS){
+    // the space freed may be enough for several
+    // waiting operations.
+    wakeup(&log);
+  } else {
+    // begin_trans() may be waiting for log space,
+    // and decrementing log.outstanding has freed
+    // one operation's worth of reserved space.
+    wakeup_one(&log);
+  }
+  release(&log.lock);
+
+  if(do_commit){
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// Copy modified blocks from cache to log.
+static void 
+write_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.lh.n; tail++) {
+    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, log.lh.sector[tail]); // cache block
+    memmove(to->data, from->data, BSIZE);
+    bwrite(to);  // write the log
+    brelse(from); 
+    brelse(to);
+  }
+}
+
+static void
+commit()
 {
   if (log.lh.n > 0) {
+    write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
     install_trans(); // Now install writes to home locations
     log.lh.n = 0; 
     write_head();    // Erase the transaction from the log
   }
-  
-  acquire(&log.lock);
-  log.busy = 0;
-  wakeup(&log);
-  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Append the block to the log and record the block number, 
-// but don't write the log header (which would commit the write).
+// Record the block number and pin in the cache with B_DIRTY.
+// commit()/write_log() will do the disk write.
+//
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
 //   modify bp->data[]
@@ -162,23 +265,21 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  acquire(&log.lock);
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
-  if (!log.busy)
+  if (log.outstanding < 1)
     panic("write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.sector[i] == b->sector)   // log absorbtion?
+    if (log.lh.sector[i] == b->sector)   // log absorbtion
       break;
   }
   log.lh.sector[i] = b->sector;
-  struct buf *lbuf = bread(b->dev, log.start+i+1);
-  memmove(lbuf->data, b->data, BSIZE);
-  bwrite(lbuf);
-  brelse(lbuf);
   if (i == log.lh.n)
     log.lh.n++;
-  b->flags |= B_DIRTY; // XXX prevent eviction
+  b->flags |= B_DIRTY; // prevent eviction
+  release(&log.lock);
 }
 
 //PAGEBREAK!
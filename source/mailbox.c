@@ -56,6 +56,10 @@ create_request(volatile u_int32 *mbuf, u_int32 tag, u_int32 buflen, u_int32 len,
 
 volatile u_int32 *mail_buffer;
 
+/* The message sent by the last writemailbox(), which the
+ * VideoCore writes its reply into. */
+static u_int32 mail_va1, mail_va2;
+
 void mailboxinit()
 {
 mail_buffer = (u_int32 *)kalloc();
@@ -72,6 +76,10 @@ again:
 	z = x & 0xf; y = (u_int32)(channel & 0xf);
 	if(z != y) goto again;
 
+	/* Drop any line of the message the D-cache fetched while
+	 * the VideoCore was answering, so the reply is read. */
+	flush_dcache(mail_va1, mail_va2);
+
 	return x&0xfffffff0;
 }
 
@@ -86,7 +94,13 @@ writemailbox(u_int32 *addr, u_char8 channel)
 	x = a & 0xfffffff0;
 	y = x | (u_int32)(channel & 0xf);
 
+	/* The VideoCore reads and answers the message in memory.
+	 * A property message (channel 8) starts with its length;
+	 * channel 1 carries a frame_buf_desc. */
+	mail_va1 = (u_int32)addr;
+	mail_va2 = mail_va1 + (channel == 8 ? addr[0] : sizeof(frame_buf_desc));
 	flush_dcache_all();
+	flush_dcache(mail_va1, mail_va2);
 
 	while ((inw(MAILBOX_BASE+24) & 0x80000000) != 0);
 	//while ((inw(MAILBOX_BASE+0x38) & 0x80000000) != 0);
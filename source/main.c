@@ -157,13 +157,45 @@ unsigned int get_pm_size()
  * Initialises data structures for multiple CPUs or cores.
  *
  * 'machinit' initialises memory used to store the state of
- * each CPU in a multiprocessing system.
+ * each CPU in a multiprocessing system, and makes cpus[0]
+ * the boot CPU's local storage.
  *
  * @see struct cpu, in proc.c
  */
 void machinit(void)
 {
     memset(cpus, 0, sizeof(struct cpu) * NCPU);
+    cpus[0].cpu = &cpus[0];
+    set_this_cpu(&cpus[0]);
+}
+
+
+/**
+ * mpmain() initialises a secondary CPU and enters its
+ * scheduler.
+ *
+ * Secondary CPUs are started by mpstart() once CPU 0 has
+ * initialised the kernel, and arrive here from entry.S on
+ * the stack mpstart() allocated. Each one sets up its own
+ * local storage, address space split, trap stacks and
+ * scheduling tick.
+ *
+ * @param id - The core number from MPIDR.
+ */
+void mpmain(int id)
+{
+    struct cpu* c;
+    c = &cpus[id];
+    c->id = id;
+    c->cpu = c;
+    set_this_cpu(c);
+    kvmcpuinit();
+    init_mode_stacks();
+    localtimerinit();
+    cprintf("cpu%d: starting\n", id);
+    dsb_barrier();
+    c->started = 1;
+    scheduler();
 }
 
 
@@ -204,24 +236,29 @@ int cmain()
     pm_size = get_pm_size();
     cprintf("ARM memory is %x\n", pm_size);
     mmu_init_stage2();
+    asidinit();
     gpuinit();
     pinit();
     tv_init();
     cprintf("%s: Ok after tv_init\n", __func__);
-    binit();
-    cprintf("%s: Ok after binit\n", __func__);
     fileinit();
     cprintf("%s: Ok after fileinit\n", __func__);
-    iinit();
-    cprintf("%s: Ok after iinit\n", __func__);
     ideinit();
     cprintf("%s: Ok after ideinit\n", __func__);
     kinit2(P2V((8 * 1024 * 1024) + PHYSTART), P2V(pm_size));
     cprintf("%s: Ok after kinit2\n", __func__);
+    dmainit();
+    cprintf("%s: Ok after dmainit\n", __func__);
+    binit();
+    cprintf("%s: Ok after binit\n", __func__);
+    iinit();
+    cprintf("%s: Ok after iinit\n", __func__);
     userinit();
     cprintf("%s: Ok after userinit\n", __func__);
     timer3init();
     cprintf("%s: Ok after timer3init\n", __func__);
+    mpstart();
+    cprintf("%s: %d cpus running\n", __func__, ncpu);
     scheduler();
     not_ok_loop();
     return 0;
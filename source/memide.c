@@ -1,5 +1,8 @@
 // Fake IDE disk; stores blocks in memory.
 // Useful for running kernel without scratch disk.
+// Not built with 'make disk=emmc'; see emmc.c.
+
+#ifndef EMMC
 
 #include "types.h"
 #include "defs.h"
@@ -10,6 +13,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "fs.h"
 
 extern u_char8 _binary_fs_img_start[], _binary_fs_img_end[];
 
@@ -20,7 +24,7 @@ void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
-  disksize = div(((u_int32)_binary_fs_img_end - (u_int32)_binary_fs_img_start), 512);
+  disksize = ((u_int32)_binary_fs_img_end - (u_int32)_binary_fs_img_start) / BSIZE;
 }
 
 // Interrupt handler.
@@ -33,6 +37,8 @@ ideintr(void)
 // Sync buf with disk. 
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, release buf when done; as the memory
+// disk is synchronous, that is before returning.
 void
 iderw(struct buf *b)
 {
@@ -47,12 +53,19 @@ iderw(struct buf *b)
   if(b->sector >= disksize)
     panic("iderw: sector out of range");
 
-  p = memdisk + b->sector*512;
+  p = memdisk + b->sector*BSIZE;
   
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, 512);
-  } else
-    memmove(b->data, p, 512);
+    if(dmacopy(p, b->data, BSIZE) < 0)
+      memmove(p, b->data, BSIZE);
+  } else if(dmacopy(b->data, p, BSIZE) < 0)
+    memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    brelse(b);
+  }
 }
+
+#endif
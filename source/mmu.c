@@ -87,8 +87,7 @@ void mmu_init_stage1(void)
                     | PDX_ATRB_DOMAIN0
                     | PDX_ATRB_AP(PTX_ATRB_KRW)
                     | PDX_ATRB_SECTION_ENTRY
-                    | PTX_ATRB_CACHED
-                    | PTX_ATRB_BUFFERED;
+                    | PDX_ATRB_KMEM;
         va += MBYTE;
     }
 	/* Map the memory mapped I/O devices from PA 0x3f000000
@@ -101,6 +100,14 @@ void mmu_init_stage1(void)
                     | PDX_ATRB_SECTION_ENTRY;
         va += MBYTE;
     }
+#ifdef RPI2
+	/* Map the BCM2836 per-core peripherals (mailboxes, local
+	 * timers and interrupts) from PA 0x40000000 to LOCAL_VA. */
+    l1[PDX(LOCAL_VA)] = LOCAL_PA
+                | PDX_ATRB_DOMAIN0
+                | PDX_ATRB_AP(PTX_ATRB_KRW)
+                | PDX_ATRB_SECTION_ENTRY;
+#endif
 	/* Map 1Gb of GPU memory, from PA 0x0 to VA 0x40000000.
 	 * The GPU buffer is nonfunctional in the XV6 for RPI2
 	 * RPI 3.
@@ -171,8 +178,7 @@ void mmu_init_stage2(void)
                 | PDX_ATRB_DOMAIN0
                 | PDX_ATRB_AP(PTX_ATRB_KRW)
                 | PDX_ATRB_SECTION_ENTRY
-                | PTX_ATRB_CACHED
-                | PTX_ATRB_BUFFERED;
+                | PDX_ATRB_KMEM;
         va += MBYTE;
     }
 	/* Undo identity map of first MB of ram
@@ -195,3 +201,27 @@ void mmu_init_stage2(void)
     flush_tlb();
 }
 
+
+/**
+ * Maps part of the GPU memory window as write-combining memory.
+ *
+ * mmu_gpumem_wc remaps the sections of the GPU memory window
+ * which hold [va, va + n), such as the framebuffer, as normal
+ * uncached memory, so the CPU can merge writes to them. The
+ * rest of the window stays strongly-ordered: it includes the
+ * peripherals, which must not be read speculatively.
+ *
+ * @param va - The start of the range, in the GPU memory window.
+ * @param n - The length of the range, in bytes.
+ */
+void mmu_gpumem_wc(u_int32 va, u_int32 n)
+{
+    pde_t* l1;
+    u_int32 a;
+    l1 = (pde_t*) p2v(K_PDX_BASE);
+    for (a = va & ~(MBYTE - 1); a < va + n; a += MBYTE) {
+        l1[PDX(a)] |= PDX_ATRB_TEX_NORMAL;
+    }
+    flush_dcache((u_int32) &l1[PDX(va)], (u_int32) &l1[PDX(va + n - 1) + 1]);
+    flush_tlb();
+}
@@ -0,0 +1,123 @@
+/**
+ * @file mp.c
+ *
+ * mp.c starts the secondary CPUs of a multiprocessor.
+ *
+ * On the Raspberry Pi 2, the firmware parks cores 1 to 3 in a
+ * loop which waits for an entry address to be written to the
+ * core's BCM2836 mailbox 3. mpstart() sends each core to the
+ * kernel entry point in entry.S, which enables the MMU and
+ * enters mpmain() on a stack allocated here.
+ *
+ * The other supported boards have a single core.
+ *
+ * @see mpmain() in main.c
+ */
+
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "arm.h"
+#include "proc.h"
+#include "mailbox.h"
+
+
+/** The number of cores on the BCM2836. */
+#define MPCORES 4
+
+
+/** How long to poll for a core to come up before giving up. */
+#define MP_TIMEOUT 10000000
+
+
+/** The number of started CPUs. */
+int ncpu = 1;
+
+
+/**
+ * The initial stack pointer of the CPU being started.
+ *
+ * @see mp_enter in entry.S.
+ */
+char* mp_stack;
+
+
+extern pde_t* kernel_page_dir;
+
+
+/**
+ * Writes a page directory entry back to memory, where a CPU
+ * walking the page directory with its caches off can see it.
+ *
+ * @param pde - The page directory entry.
+ */
+static void mp_flush_pde(pde_t* pde)
+{
+    u_int32 va1;
+    u_int32 va2;
+    va1 = (u_int32) pde & ~((u_int32) CACHE_LINE_SIZE - 1);
+    va2 = ((u_int32) pde + sizeof(pde_t)) & ~((u_int32) CACHE_LINE_SIZE - 1);
+    flush_dcache(va1, va2);
+    dsb_barrier();
+}
+
+
+/**
+ * Starts the secondary CPUs.
+ *
+ * The kernel entry point runs with the MMU off, so the
+ * identity map of the first MB of memory removed by
+ * mmu_init_stage2() is restored while the CPUs start.
+ * CPUs are started one at a time, and each must report
+ * started before the next is sent, as they share mp_stack.
+ *
+ * A CPU which does not start in time (for example, under
+ * an emulator configured with fewer cores) is skipped,
+ * along with every CPU after it.
+ */
+void mpstart(void)
+{
+    cpus[0].started = 1;
+#ifdef RPI2
+    extern char _start[];
+    pde_t* l1;
+    char* stack;
+    int i;
+    int t;
+    l1 = kernel_page_dir;
+    l1[PDX(PHYSTART)] = PHYSTART
+                    | PDX_ATRB_DOMAIN0
+                    | PDX_ATRB_AP(PTX_ATRB_KRW)
+                    | PDX_ATRB_SECTION_ENTRY
+                    | PDX_ATRB_KMEM;
+    mp_flush_pde(&l1[PDX(PHYSTART)]);
+    for (i = 1; i < MPCORES && i < NCPU; i++) {
+        if ((stack = kalloc()) == 0) {
+            break;
+        }
+        memset(stack, 0, PGSIZE);
+        mp_stack = stack + PGSIZE;
+        dsb_barrier();
+        /* _start is linked at its physical address. */
+        outw(CORE_MBOX3_SET(i), (u_int32) _start);
+        send_event();
+        for (t = 0; t < MP_TIMEOUT && !cpus[i].started; t++) {
+            ;
+        }
+        if (!cpus[i].started) {
+            cprintf("cpu%d: did not start\n", i);
+            kfree(stack);
+            break;
+        }
+        ncpu++;
+    }
+    /* Every started CPU has left the identity map, and now
+     * translates low addresses through TTBR0. */
+    l1[PDX(PHYSTART)] = 0;
+    mp_flush_pde(&l1[PDX(PHYSTART)]);
+    flush_tlb();
+#endif
+}
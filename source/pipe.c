@@ -7,21 +7,46 @@
 #include "file.h"
 #include "spinlock.h"
 
-#define PIPESIZE 512
+#define PIPEPAGES 4  // pages in a pipe's ring; a power of two
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
+// The data of a pipe is a ring of whole pages. Bytes are moved
+// with memmove, a page (or the rest of one) at a time. A reader
+// asking for a whole, page-aligned page of data at a page
+// boundary of the ring is handed the ring's page itself, which
+// is exchanged for the page it replaces in the reader's memory.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];  // the ring's pages, in order
   u_int32 nread;     // number of bytes read
   u_int32 nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// The page of p's ring holding byte number off.
+static char**
+pipepage(struct pipe *p, u_int32 off)
+{
+  return &p->page[(off / PGSIZE) % PIPEPAGES];
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->page[i])
+      kfree(p->page[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -29,7 +54,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
-  memset(p, 0, PGSIZE);
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->page[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +76,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,7 +97,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
@@ -78,21 +106,31 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || curr_proc->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      wakeup_one(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    // Copy up to the end of the free space, or of the page.
+    m = n - i;
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    if(m > PGSIZE - p->nwrite % PGSIZE)
+      m = PGSIZE - p->nwrite % PGSIZE;
+    memmove(*pipepage(p, p->nwrite) + p->nwrite % PGSIZE, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup_1
+  wakeup_one(&p->nread);  //DOC: pipewrite-wakeup_1
+  // Pass the wakeup on to another writer if there is room.
+  if(p->nwrite != p->nread + PIPESIZE)
+    wakeup_one(&p->nwrite);
   release(&p->lock);
   return n;
 }
@@ -100,7 +138,8 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
+  char **pg;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +149,27 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    pg = pipepage(p, p->nread);
+    if(p->nread % PGSIZE == 0 && p->nwrite - p->nread >= PGSIZE &&
+       n - i >= PGSIZE && (u_int32)(addr + i) % PGSIZE == 0 &&
+       pageflip(curr_proc, (u_int32)(addr + i), pg) == 0){
+      m = PGSIZE;
+    } else {
+      // Copy up to the end of the data, or of the page.
+      m = n - i;
+      if(m > p->nwrite - p->nread)
+        m = p->nwrite - p->nread;
+      if(m > PGSIZE - p->nread % PGSIZE)
+        m = PGSIZE - p->nread % PGSIZE;
+      memmove(addr + i, *pg + p->nread % PGSIZE, m);
+    }
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  wakeup_one(&p->nwrite);  //DOC: piperead-wakeup
+  // Pass the wakeup on to another reader if data is left.
+  if(p->nread != p->nwrite)
+    wakeup_one(&p->nread);
   release(&p->lock);
   return i;
 }
@@ -48,6 +48,62 @@ struct {
 } ptable;
 
 
+/**
+ * @struct runq - A per-CPU run queue.
+ *
+ * Each CPU runs processes from its own run queue, which
+ * holds a FIFO of RUNNABLE processes for each priority level
+ * and a bitmap of the non-empty levels. Picking the next
+ * process is therefore independent of NPROC.
+ *
+ * The run queue lock guards the RUNNABLE, RUNNING and SLEEPING
+ * state changes of its processes, and is held across the
+ * swtch() between a process and its CPU's scheduler, the role
+ * ptable.lock used to play. ptable.lock still guards process
+ * allocation, parent links, and the ZOMBIE state. When both
+ * are needed, ptable.lock is acquired first. A CPU which has
+ * nothing to run moves processes to its queue from a busier
+ * one (steal_proc()).
+ */
+struct runq {
+    struct spinlock lock;       /**< Lock to synchronize the run queue. */
+    struct proc* head[NPRIO];   /**< Next process to run at each priority. */
+    struct proc* tail[NPRIO];   /**< Last process to run at each priority. */
+    u_int32 ready;              /**< Bit n is set if head[n] is not empty. */
+    int nready;                 /**< The number of queued processes. */
+};
+
+static struct runq runqs[NCPU];
+
+
+/**
+ * @struct waitq - A bucket of the wait channel hash table.
+ *
+ * Each SLEEPING process is queued, oldest first, in the
+ * bucket its channel hashes to, so a wakeup only looks at
+ * processes sleeping on channels in that bucket.
+ *
+ * A bucket lock is acquired before any run queue lock, and
+ * is held while a process sets its channel and goes to sleep,
+ * and while a wakeup removes it.
+ */
+struct waitq {
+    struct spinlock lock;       /**< Lock to synchronize the bucket. */
+    struct proc* head;          /**< Longest sleeping process. */
+    struct proc* tail;          /**< Most recently sleeping process. */
+};
+
+
+/** The number of wait channel buckets (prime). */
+#define NWAITQ 127
+
+static struct waitq waitqs[NWAITQ];
+
+
+/** The priority of the first process, and of processes by default. */
+#define DEFAULT_PRIORITY (NPRIO / 2)
+
+
 /**
  * A local pointer to the initial process.
  *
@@ -83,7 +139,6 @@ int next_pid = 1;
 extern void fork_return(void);
 extern void trapret(void);
 
-static void wakeup_1(void *chan);
 static struct proc* spawn_proc(struct proc *p);
 
 
@@ -96,8 +151,207 @@ static struct proc* spawn_proc(struct proc *p);
  */
 void pinit(void)
 {
+    int i;
     memset(&ptable, 0, sizeof(ptable));
     initlock(&ptable.lock, "ptable");
+    memset(runqs, 0, sizeof(runqs));
+    for (i = 0; i < NCPU; i++) {
+        initlock(&runqs[i].lock, "runq");
+    }
+    memset(waitqs, 0, sizeof(waitqs));
+    for (i = 0; i < NWAITQ; i++) {
+        initlock(&waitqs[i].lock, "waitq");
+    }
+}
+
+
+/**
+ * Returns the wait channel bucket for a channel.
+ *
+ * @param chan - A wait channel.
+ * @return The bucket holding the processes sleeping on chan.
+ */
+static struct waitq* chan_waitq(void* chan)
+{
+    return &waitqs[((u_int32) chan >> 2) % NWAITQ];
+}
+
+
+/**
+ * Removes a process from a wait channel bucket.
+ *
+ * @warning The caller must hold the bucket lock.
+ *
+ * @param wq - The bucket holding the process.
+ * @param p - The process to remove.
+ */
+static void waitq_remove(struct waitq* wq, struct proc* p)
+{
+    struct proc** pp;
+    struct proc* prev;
+    prev = 0;
+    for (pp = &wq->head; *pp != p; pp = &(*pp)->wq_next) {
+        prev = *pp;
+    }
+    *pp = p->wq_next;
+    if (wq->tail == p) {
+        wq->tail = prev;
+    }
+    p->wq_next = 0;
+}
+
+
+/**
+ * Returns the run queue which holds a process.
+ *
+ * @param p - The process.
+ * @return The run queue of the CPU the process is assigned to.
+ */
+static struct runq* proc_rq(struct proc* p)
+{
+    return &runqs[p->rq_cpu];
+}
+
+
+/**
+ * Marks a process RUNNABLE and appends it to its run queue.
+ *
+ * @warning The caller must hold the process' run queue lock.
+ *
+ * @param p - The process to make runnable.
+ */
+static void make_runnable(struct proc* p)
+{
+    struct runq* rq;
+    rq = proc_rq(p);
+    p->state = RUNNABLE;
+    p->rq_next = 0;
+    if (rq->tail[p->priority]) {
+        rq->tail[p->priority]->rq_next = p;
+    } else {
+        rq->head[p->priority] = p;
+    }
+    rq->tail[p->priority] = p;
+    rq->ready |= 1 << p->priority;
+    rq->nready++;
+}
+
+
+/**
+ * Removes the next process to run from a run queue.
+ *
+ * The next process is the oldest process at the highest
+ * priority level (lowest number) with a runnable process.
+ *
+ * @warning The caller must hold the run queue lock.
+ *
+ * @param rq - The run queue.
+ * @return The process to run, or 0 if the queue is empty.
+ */
+static struct proc* rq_pop(struct runq* rq)
+{
+    struct proc* p;
+    int prio;
+    if (rq->ready == 0) {
+        return 0;
+    }
+    for (prio = 0; !(rq->ready & (1 << prio)); prio++) {
+        ;
+    }
+    p = rq->head[prio];
+    rq->head[prio] = p->rq_next;
+    if (rq->head[prio] == 0) {
+        rq->tail[prio] = 0;
+        rq->ready &= ~(1 << prio);
+    }
+    p->rq_next = 0;
+    rq->nready--;
+    return p;
+}
+
+
+/**
+ * Finds the CPU with the fewest runnable processes.
+ *
+ * The run queue lengths are read without their locks, so the
+ * answer is only a hint, which is all placement needs.
+ *
+ * @return The index in cpus of the least loaded CPU.
+ */
+static int least_loaded_cpu(void)
+{
+    int best;
+    int i;
+    best = curr_cpu - cpus;
+    for (i = 0; i < ncpu; i++) {
+        if (runqs[i].nready < runqs[best].nready) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+/**
+ * Moves a runnable process to an idle CPU's run queue.
+ *
+ * steal_proc takes the next process of the longest run queue
+ * of a CPU which is busy running a process, so a CPU which has
+ * run out of work helps one which has more than it can run,
+ * rather than
+ * waiting in WFE. Processes are placed at fork, and otherwise
+ * stay on their CPU, so without stealing one CPU could be
+ * saturated while the others sit idle.
+ *
+ * Only a queued process is moved: it is not running, so
+ * nothing but its run queue refers to its CPU, and both run
+ * queue locks are held, lower index first, while it moves.
+ *
+ * @param rq - The idle CPU's run queue, which must not be
+ * locked by the caller.
+ * @return 1 if a process was moved to rq, otherwise 0.
+ */
+static int steal_proc(struct runq* rq)
+{
+    struct runq* victim;
+    struct proc* p;
+    int i;
+    /* The lengths are read without locks, as a hint. An idle
+     * CPU's queue is left to it, to avoid bouncing processes. */
+    victim = 0;
+    for (i = 0; i < ncpu; i++) {
+        if (&runqs[i] != rq && runqs[i].nready > 0 && cpus[i].proc != 0 &&
+            (victim == 0 || runqs[i].nready > victim->nready)) {
+            victim = &runqs[i];
+        }
+    }
+    if (victim == 0) {
+        return 0;
+    }
+    acquire(victim < rq ? &victim->lock : &rq->lock);
+    acquire(victim < rq ? &rq->lock : &victim->lock);
+    if ((p = rq_pop(victim)) != 0) {
+        p->rq_cpu = rq - runqs;
+        make_runnable(p);
+    }
+    release(&victim->lock);
+    release(&rq->lock);
+    return p != 0;
+}
+
+
+/**
+ * Makes a new process runnable for the first time.
+ *
+ * @param p - An EMBRYO process which is ready to run.
+ */
+static void start_proc(struct proc* p)
+{
+    struct runq* rq;
+    rq = proc_rq(p);
+    acquire(&rq->lock);
+    make_runnable(p);
+    release(&rq->lock);
 }
 
 
@@ -147,6 +401,15 @@ static struct proc* spawn_proc(struct proc *p)
     char* sp;
     p->state = EMBRYO;
     p->pid = next_pid++;
+    /* Never inherit the ASID of the slot's previous owner, whose
+     * TLB entries may still be cached. */
+    p->context_id = 0;
+    /* Balance the CPUs' loads by placing each new process on
+     * the shortest run queue. An idle CPU later takes queued
+     * processes from busier ones: see steal_proc(). */
+    p->rq_cpu = least_loaded_cpu();
+    p->rq_next = 0;
+    p->priority = DEFAULT_PRIORITY;
     release(&ptable.lock);
     /* Allocate a kernel stack for the process. */
     if ((p->kstack = kalloc()) == 0){
@@ -210,7 +473,7 @@ void userinit(void)
     p->tf->pc = 0;   /*< beginning of initcode.S */
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
-    p->state = RUNNABLE;
+    start_proc(p);
 }
 
 
@@ -222,6 +485,11 @@ void userinit(void)
  * increase or decrease the amount of virtual memory
  * allocated and mapped into the current process.
  *
+ * Growing the memory only reserves it: each page is mapped
+ * by pagefault() when it is first touched. A request for
+ * more pages than are free still fails at once, as it would
+ * if the pages were allocated eagerly.
+ *
  * @param n - Expand the memory by 'n' bytes (or
  *            decrease with a negative 'n'.
  *
@@ -232,16 +500,21 @@ int growproc(int n)
     u_int32 sz;
     sz = curr_proc->sz;
     if (n > 0){
-        if ((sz = allocuvm(curr_proc->pgdir, sz, sz + n)) == 0) {
+        if (sz + n < sz || sz + n >= USERBOUND
+                || PG_ROUND_UP((u_int32) n) / PGSIZE > kfreepages()) {
             return -1;
         }
+        sz += n;
     } else if (n < 0) {
         if ((sz = deallocuvm(curr_proc->pgdir, sz, sz + n)) == 0) {
             return -1;
         }
     }
     curr_proc->sz = sz;
-    switchuvm(curr_proc);
+    /* Removed mappings must leave the TLB. */
+    if (n < 0) {
+        flushuvm(curr_proc);
+    }
     return 0;
 }
 
@@ -254,6 +527,10 @@ int growproc(int n)
  * unique PID. The new process will become the child of the
  * calling process.
  *
+ * The memory is not copied up front: parent and child share
+ * each page copy-on-write, so fork() followed by exec() does
+ * not copy the parent's memory at all.
+ *
  * fork() will set up the new process' stack to return as
  * if from a system call.
  *
@@ -284,6 +561,8 @@ int fork(void)
         new_proc->state = UNUSED;
         return -1;
     }
+    /* The parent's pages are now shared read-only. */
+    flushuvm(curr_proc);
     new_proc->sz = curr_proc->sz;
     new_proc->parent = curr_proc;
     *new_proc->tf = *curr_proc->tf;
@@ -296,9 +575,17 @@ int fork(void)
         }
     }
     new_proc->cwd = idup(curr_proc->cwd);
+    new_proc->exe = curr_proc->exe ? idup(curr_proc->exe) : 0;
+    /* Cannot fail: a running exe has no writable opens. */
+    if (new_proc->exe) {
+        idenywrite(new_proc->exe);
+    }
+    memmove(new_proc->seg, curr_proc->seg, sizeof(curr_proc->seg));
+    new_proc->nseg = curr_proc->nseg;
+    new_proc->priority = curr_proc->priority;
     pid = new_proc->pid;
-    new_proc->state = RUNNABLE;
     safestrcpy(new_proc->name, curr_proc->name, sizeof(curr_proc->name));
+    start_proc(new_proc);
     return pid;
 }
 
@@ -308,7 +595,7 @@ int fork(void)
  *
  * exit terminates the current process by:
  *  - Closing all files opened by the process.
- *  - Close the inode used by the process.
+ *  - Close the inodes used by the process.
  *  - Wakeup the parent, if it's sleeping.
  *  - Re-parent child processes to the initial process.
  *  - Set the process state to ZOMBIE, never to be
@@ -335,23 +622,33 @@ void exit(void)
             curr_proc->ofile[fd] = 0;
          }
     }
-    /* Free the inode used by the process. */
+    /* Free the inodes used by the process. */
     iput(curr_proc->cwd);
     curr_proc->cwd = 0;
+    if (curr_proc->exe) {
+        iallowwrite(curr_proc->exe);
+        iput(curr_proc->exe);
+        curr_proc->exe = 0;
+    }
     acquire(&ptable.lock);
     /* Wakeup the parent, if parent is wait()ing. */
-    wakeup_1(curr_proc->parent);
+    wakeup(curr_proc->parent);
     /* Pass the abandoned children to the init process. */
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
         if (p->parent == curr_proc){
             p->parent = init_proc;
             if (p->state == ZOMBIE) {
-                wakeup_1(init_proc);
+                wakeup(init_proc);
             }
         }
     }
-    /* Jump into the scheduler, never to return. */
+    /* Jump into the scheduler, never to return. The parent
+     * may see the ZOMBIE state as soon as ptable.lock is
+     * released, but can not free our stack until the run
+     * queue lock is released by the scheduler. */
+    acquire(&proc_rq(curr_proc)->lock);
     curr_proc->state = ZOMBIE;
+    release(&ptable.lock);
     sched();
     panic("zombie exit");
 }
@@ -388,6 +685,10 @@ int wait(void)
             has_children = 1;
             if(p->state == ZOMBIE){
                 pid = p->pid;
+                /* Wait for the child's CPU to switch off the
+                 * kernel stack. See exit(). */
+                acquire(&proc_rq(p)->lock);
+                release(&proc_rq(p)->lock);
                 kfree(p->kstack);
                 p->kstack = 0;
                 freevm(p->pgdir);
@@ -406,7 +707,7 @@ int wait(void)
             return -1;
         }
         /* Release the lock and do not execute until a child exits.
-         * See wakeup_1() call in exit, which wakes the parent when
+         * See wakeup() call in exit, which wakes the parent when
          * a child terminates. */
         sleep(curr_proc, &ptable.lock);
     }
@@ -432,9 +733,9 @@ int wait(void)
  * @note Each CPU should call scheduler() after setting
  * itself up.
  *
- * @note Processes are responsible for releasing ptable.lock
- * when they are switched to, and re-acquiring it before
- * the swtch back to the scheduler, as well as changing
+ * @note Processes are responsible for releasing their run
+ * queue lock when they are switched to, and re-acquiring it
+ * before the swtch back to the scheduler, as well as changing
  * their state to and from RUNNABLE. Normally this would be
  * done by sleep() and yield() in the course of normal
  * operation.
@@ -442,6 +743,8 @@ int wait(void)
 void scheduler(void)
 {
     struct proc *p;
+    struct runq *rq;
+    rq = &runqs[curr_cpu - cpus];
     for (;;) {
         /* Enable interrupts on this processor.
          * If this is the first call to scheduler,
@@ -452,25 +755,41 @@ void scheduler(void)
         } else {
             sti();
         }
-        /* Loop over process table looking for process to run. */
-        acquire(&ptable.lock);
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if (p->state != RUNNABLE) {
-                continue;
-            }
+        /* Take the next process from this CPU's run queue. */
+        acquire(&rq->lock);
+        if ((p = rq_pop(rq)) != 0) {
             // Switch to chosen process.  It is the process's job
-            // to release ptable.lock and then reacquire it
+            // to release the run queue lock and then reacquire it
             // before jumping back to us.
             curr_proc = p;
             switchuvm(p);
             p->state = RUNNING;
+            p->slice = TIMESLICE;
+            tickstart();
             swtch(&curr_cpu->scheduler, curr_proc->context);
             /* The context will switch back here after the
              * process is suspended running. */
             switchkvm();
             curr_proc = 0;
         }
-        release(&ptable.lock);
+        release(&rq->lock);
+        /* Nothing was runnable here: take a process queued
+         * on a busier CPU. */
+        if (!p && steal_proc(rq)) {
+            continue;
+        }
+        /* Nothing was runnable: use the idle time to zero
+         * a page ahead of the next kzalloc(), or else wait
+         * for an interrupt, or for the SEV of the unlock
+         * which makes a process runnable here. This CPU's
+         * own unlocks leave an event pending: the first
+         * WFE clears it. */
+        if (!p && !kzeroidle()) {
+            wait_event();
+            if (rq->nready == 0) {
+                wait_event();
+            }
+        }
     }
 }
 
@@ -479,8 +798,8 @@ void scheduler(void)
  * Enter the scheduler for the current CPU.
  *
  * sched ("Schedule") context switches to the scheduler for
- * the current CPU. The process should hold ptable.lock,
- * and also hold no other locks, to prevent deadlocks.
+ * the current CPU. The process should hold its run queue
+ * lock, and also hold no other locks, to prevent deadlocks.
  *
  * The calling process is also responsible for changing
  * it's process state from RUNNING to an appropriate state
@@ -492,8 +811,8 @@ void scheduler(void)
 void sched(void)
 {
     int irq_enabled;
-    if (!holding(&ptable.lock)) {
-        panic("sched ptable.lock");
+    if (!holding(&proc_rq(curr_proc)->lock)) {
+        panic("sched runq.lock");
     }
     if (curr_cpu->ncli != 1) {
         panic("sched locks");
@@ -518,16 +837,44 @@ void sched(void)
  * process if performing a long task, or momentarily
  * waiting on I/O, to allow other processes to continue.
  *
- * yeild will acquire the process table lock and change
- * the process' state as required to call into the
- * scheduler.
+ * yeild will acquire the run queue lock and put the
+ * process at the back of its run queue before calling
+ * into the scheduler.
  */
 void yield(void)
 {
-    acquire(&ptable.lock);
-    curr_proc->state = RUNNABLE;
+    acquire(&proc_rq(curr_proc)->lock);
+    make_runnable(curr_proc);
     sched();
-    release(&ptable.lock);
+    release(&proc_rq(curr_proc)->lock);
+}
+
+
+/**
+ * Sets the scheduling priority of the current process.
+ *
+ * The new priority takes effect the next time the
+ * process is queued to run.
+ *
+ * A process can only lower its priority. Scheduling is by
+ * strict priority, so a CPU-bound process which could raise
+ * itself above the default would starve every other process
+ * on its CPU, including init and the shell.
+ *
+ * @param priority - The priority, from the current one
+ *                   to NPRIO - 1 (lowest).
+ * @return 0 on success, -1 if the priority is invalid or
+ * higher than the current one.
+ */
+int setpriority(int priority)
+{
+    if (priority < curr_proc->priority || priority >= NPRIO) {
+        return -1;
+    }
+    acquire(&proc_rq(curr_proc)->lock);
+    curr_proc->priority = priority;
+    release(&proc_rq(curr_proc)->lock);
+    return 0;
 }
 
 
@@ -547,14 +894,15 @@ void yield(void)
 void fork_return(void)
 {
     static int first_proc = 1;
-    // Still holding ptable.lock from scheduler.
-    release(&ptable.lock);
+    // Still holding the run queue lock from scheduler.
+    release(&proc_rq(curr_proc)->lock);
     if (first_proc) {
         /* Some initialization functions must be run in the context
          * of a regular process (e.g., they call sleep), and thus cannot
          * be run from main(). */
         first_proc = 0;
         initlog();
+        fsinit(ROOTDEV);
     }
     return;
 }
@@ -576,73 +924,141 @@ void fork_return(void)
  */
 void sleep(void* chan, struct spinlock* lk)
 {
+    struct waitq* wq;
     if (curr_proc == 0) {
         panic("sleep");
     }
     if (lk == 0) {
         panic("sleep without lk");
     }
-    /* We must acquire ptable.lock in order to
+    /* We must acquire the run queue lock in order to
      * change p->state and then call sched.
-     * Once we hold ptable.lock, we can be
-     * guaranteed that we won't miss any wakeup
-     * (wakeup runs with ptable.lock locked),
-     * so it's okay to release lk. */
-    if (lk != &ptable.lock){
-        acquire(&ptable.lock);
-        release(lk);
-    }
+     * The process is queued on the channel and marked
+     * SLEEPING before lk is released, and wakeup() holds
+     * the channel's bucket lock to find it, so we can't
+     * miss a wakeup issued by anyone holding lk. */
+    wq = chan_waitq(chan);
+    acquire(&wq->lock);
     curr_proc->channel = chan;
+    curr_proc->wq_next = 0;
+    if (wq->tail) {
+        wq->tail->wq_next = curr_proc;
+    } else {
+        wq->head = curr_proc;
+    }
+    wq->tail = curr_proc;
+    acquire(&proc_rq(curr_proc)->lock);
     curr_proc->state = SLEEPING;
+    release(&wq->lock);
+    release(lk);
     sched();
-    /* Process resumes here after wakeup. Clean up. */
+    /* Process resumes here after wakeup, which has
+     * already removed it from the channel. Clean up. */
     curr_proc->channel = 0;
     /* Reacquire original lock. */
-    if (lk != &ptable.lock){
-        release(&ptable.lock);
-        acquire(lk);
-    }
+    release(&proc_rq(curr_proc)->lock);
+    acquire(lk);
 }
 
 
 /**
- * Wake up all process sleeping on a channel, without
- * locking the ptable.
+ * Wake up processes sleeping on a channel.
  *
- * @warning wakeup_1() assumes the page table lock is held.
- * If a process does not hold the ptable.lock, use wakeup()
- * instead - which will acquire and release the lock.
+ * Only the channel's hash bucket is searched. Processes are
+ * woken in the order they went to sleep.
  *
  * @param chan - Wakeup processes sleeping on this channel.
+ * @param all - Wake every sleeper if non-zero, otherwise
+ *              only the longest sleeping one.
  */
-static void wakeup_1(void *chan)
+static void wakeup_chan(void* chan, int all)
 {
+    struct waitq* wq;
     struct proc* p;
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        if (p->state == SLEEPING && p->channel == chan) {
-            p->state = RUNNABLE;
+    struct proc* next;
+    struct runq* rq;
+    wq = chan_waitq(chan);
+    acquire(&wq->lock);
+    for (p = wq->head; p != 0; p = next) {
+        next = p->wq_next;
+        if (p->channel != chan) {
+            continue;
+        }
+        waitq_remove(wq, p);
+        rq = proc_rq(p);
+        acquire(&rq->lock);
+        make_runnable(p);
+        release(&rq->lock);
+        if (!all) {
+            break;
         }
     }
+    release(&wq->lock);
 }
 
 
 /**
- * Wake up all process sleeping on a channel, after acquiring
- * the process table lock.
+ * Wake up all process sleeping on a channel.
  *
- * wakeup will acquire the process table lock, and release
- * it after waking up the processes. The process table lock
- * is required to safely modify the process table, so you
- * should use wakeup and not wakeup_l unless you know you
- * already hold ptable.lock.
+ * wakeup acquires the channel's bucket lock and the run
+ * queue lock of each sleeper. The caller may hold
+ * ptable.lock, but must not hold any run queue lock.
  *
- * @param chan - Sleep until woken up on this channel.
+ * @param chan - Wakeup processes sleeping on this channel.
  */
 void wakeup(void* chan)
 {
-    acquire(&ptable.lock);
-    wakeup_1(chan);
-    release(&ptable.lock);
+    wakeup_chan(chan, 1);
+}
+
+
+/**
+ * Wake up the longest sleeping process on a channel.
+ *
+ * wakeup_one avoids waking a herd of processes when only one
+ * of them can make progress, such as when a single buffer is
+ * released. The woken process must pass the wakeup on if it
+ * leaves work that another sleeper could do.
+ *
+ * @param chan - Wakeup a process sleeping on this channel.
+ */
+void wakeup_one(void* chan)
+{
+    wakeup_chan(chan, 0);
+}
+
+
+/**
+ * Wake a process from sleep, whatever it is sleeping on.
+ *
+ * @warning The caller must hold ptable.lock, so that the
+ * process can not exit.
+ *
+ * @param p - The process to wake up.
+ */
+static void wakeup_proc(struct proc* p)
+{
+    struct waitq* wq;
+    void* chan;
+    int done;
+    /* The process may be woken, and sleep on another channel,
+     * between reading its channel and locking the bucket. */
+    do {
+        chan = p->channel;
+        if (p->state != SLEEPING || chan == 0) {
+            return;
+        }
+        wq = chan_waitq(chan);
+        acquire(&wq->lock);
+        done = p->state == SLEEPING && p->channel == chan;
+        if (done) {
+            waitq_remove(wq, p);
+            acquire(&proc_rq(p)->lock);
+            make_runnable(p);
+            release(&proc_rq(p)->lock);
+        }
+        release(&wq->lock);
+    } while (!done);
 }
 
 
@@ -670,9 +1086,7 @@ int kill(int pid)
              * A SLEEPING process will not be run to
              * return to userspace, and so can not
              * exit. */
-            if (p->state == SLEEPING) {
-                p->state = RUNNABLE;
-            }
+            wakeup_proc(p);
          release(&ptable.lock);
          return 0;
         }
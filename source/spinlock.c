@@ -7,19 +7,10 @@
  * A spinlock is a basic locking mechanism which enters a busy-wait loop
  * until the locked resource is available.
  *
- * @warning This implementation works by disabling interrupts while the
- * critical section is execution. This is a bad technique on so many levels:
- * Firstly, this is a naive implementation because interrupts are disabled
- * while the critical section is executing: The kernel cannot be certain
- * control of the CPU will be relinquished.
- * Secondly, this approach is not suitable for multi-processing because
- * interrupts are disabled on a per-core/per-cpu basis. Another CPU/core
- * could race the lock, leading to two threads holding the lock.
- *
- * @todo Reimplement locking using ARM atomic test & set instructions.
- * This will be required for a multiprocessing implementation.
- * https://web.cs.du.edu/~cag/courses/CS/StallingsOS3e/lec-7.pdf is a
- * useful resource.
+ * Interrupts are disabled on the local CPU while a lock is held, so an
+ * interrupt handler can not deadlock against the code it interrupted.
+ * Other CPUs are excluded by an atomic LDREX/STREX test and set of the
+ * lock word. @see spin_lock and spin_unlock in entry.S.
  *
  * @author Zhiyi Huang, University of Otago, hzy@cs.otago.ac.nz
  * (Adaption from MIT XV6.)
@@ -71,8 +62,6 @@ void initlock(struct spinlock *lk, char *name)
  * @warning 'acquire' will disable interrupts until the lock is released.
  * Critical sections should be kept short and be guaranteed to exit.
  *
- * @note - The spin part of this spinlock appears to be missing. Bugged?
- *
  * @param lk - The lock to acquire.
  */
 void acquire(struct spinlock *lk)
@@ -83,7 +72,7 @@ void acquire(struct spinlock *lk)
         cprintf("lock name: %s, locked: %d, cpu: %x CPSR: %x\n", lk->name, lk->locked, lk->cpu, readcpsr());
         panic("acquire");
     }
-    lk->locked = 1;
+    spin_lock(&lk->locked);
     /* Record info about lock acquisition for debugging. */
     lk->cpu = curr_cpu;
 }
@@ -105,7 +94,7 @@ void release(struct spinlock *lk)
     }
     lk->pcs[0] = 0;
     lk->cpu = 0;
-    lk->locked = 0;
+    spin_unlock(&lk->locked);
     popcli();
 }
 
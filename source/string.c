@@ -7,6 +7,10 @@
  * string.c also provides several basic memory handling functions (memset,
  * (memcpy, memcmp) required for GCC to build a bare-metal binary.
  *
+ * When ARM_MEMFUNCS is defined, memset, memcmp, memmove and memcpy
+ * are provided by the faster assembly routines in memfunc.S instead,
+ * and the C versions here are left out.
+ *
  * @author Zhiyi Huang, University of Otago, hzy@cs.otago.ac.nz
  * (Adaption from MIT XV6.)
  *
@@ -64,6 +68,7 @@ void* memsetb(char *dst, int c, u_int32 n)
 }
 
 
+#ifndef ARM_MEMFUNCS
 /**
  * Sets bytes in a block of memory to a specified value.
  *
@@ -166,6 +171,7 @@ void* memcpy(void *dst, const void *src, u_int32 n)
 {
     return memmove(dst, src, n);
 }
+#endif
 
 
 /**
@@ -267,31 +273,3 @@ int strlen(const char *s)
   }
   return n;
 }
-
-
-/**
- * Computes integer division.
- *
- * div ("Division") computes the integer long division of 'n' / 'd'.
- *
- * Division is a surprisingly complex algorithm, so isn't provided
- * in the ARMv7 instruction set.
- *
- * @param n - The numerator to divide.
- * @param d  - The denominator to divide by.
- * @return - The integer divisor of 'n' and 'd'.
- */
-u_int32 div(u_int32 n, u_int32 d)
-{
-    u_int32 q = 0, r = 0;
-    int i;
-    for (i = 31; i >= 0; i--){
-        r = r << 1;
-        r = r | ((n >> i) & 1);
-        if (r >= d) {
-            r = r - d;
-            q = q | (1 << i);
-        }
-    }
-    return q;
-}
@@ -56,11 +56,8 @@ argint(int n, int *ip)
   return fetchint(curr_proc->tf->sp + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size n bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   
@@ -68,10 +65,33 @@ argptr(int n, char **pp, int size)
     return -1;
   if((u_int32)i >= curr_proc->sz || (u_int32)i+size > curr_proc->sz)
     return -1;
+  // Map the buffer now, while no locks are held, in case
+  // the kernel touches it holding a spinlock.
+  if(prefaultuvm(curr_proc, i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size n bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr, for a block the system call will write. Pages
+// shared copy-on-write are copied now, so that the system call
+// fails if there is no memory for a copy, rather than the
+// kernel taking a write fault it can not resolve.
+int
+argwptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -106,6 +126,9 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_kstat(void);
+extern int sys_setprio(void);
+extern int sys_usleep(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -129,6 +152,9 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_kstat]   sys_kstat,
+[SYS_setprio] sys_setprio,
+[SYS_usleep]  sys_usleep,
 };
 
 void
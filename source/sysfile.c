@@ -70,7 +70,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -107,7 +107,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
   
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -212,6 +212,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcunlink(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -302,10 +303,17 @@ sys_open(void)
       return -1;
     }
   }
+  // A program some process is running can't be written.
+  if((omode & (O_WRONLY|O_RDWR)) && igetwrite(ip) < 0){
+    iunlockput(ip);
+    return -1;
+  }
 
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
+    if(omode & (O_WRONLY|O_RDWR))
+      iputwrite(ip);
     iunlockput(ip);
     return -1;
   }
@@ -314,6 +322,7 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  memset(&f->ra, 0, sizeof(f->ra));
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -408,7 +417,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -24,6 +24,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "kstat.h"
 
 
 /**
@@ -128,48 +129,110 @@ int sys_sbrk(void)
 /** Suspend the current process for n ticks of the system
  * clock.
  *
- * @see sleep() in proc.c
+ * @see timerwait() in timer.c
  *
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, -1 if the process was killed.
  */
 int sys_sleep(void)
 {
     int n;
-    u_int32 ticks0;
     if (argint(0, &n) < 0) {
         return -1;
     }
-    acquire(&ticks_lock);
-    ticks0 = ticks;
-    /*
-     * This was "ticks - ticks0 < n".
-     * In C, < has higher precedence than -.
-     * Brackets added for clarity.
-     */
-    while (ticks - (ticks0 < n)){
-        if (curr_proc->killed){
-            release(&ticks_lock);
-            return -1;
-        }
-        /* sleep will release ticks_lock until awoken. */
-        sleep(&ticks, &ticks_lock);
+    if (n <= 0) {
+        return 0;
     }
-    release(&ticks_lock);
-    return 0;
+    return timerwait(getsystemtime() + (unsigned long long)n * TICKUS);
 }
 
 
 /**
- * Returns how many clock tick interrupts have occured
- * since the system was started.
+ * Suspend the current process for n microseconds.
+ *
+ * The process is woken by the system timer's interrupt for
+ * the deadline, rather than at a clock tick.
+ *
+ * @see timerwait() in timer.c
+ *
+ * @return 0 on success, -1 if n is negative or the process
+ * was killed.
+ */
+int sys_usleep(void)
+{
+    int n;
+    if (argint(0, &n) < 0 || n < 0) {
+        return -1;
+    }
+    return timerwait(getsystemtime() + n);
+}
+
+
+/**
+ * Returns how many clock ticks have passed since the
+ * system was started.
+ *
+ * @see timerticks() in timer.c
  *
  * @return The number of ticks since the system started.
  */
 int sys_uptime(void)
 {
-    u_int32 xticks;
-    acquire(&ticks_lock);
-    xticks = ticks;
-    release(&ticks_lock);
-    return xticks;
+    return timerticks();
+}
+
+
+/**
+ * Sets the scheduling priority of the current process.
+ *
+ * Arguments: int priority, from the current priority to
+ * NPRIO - 1 (lowest).
+ *
+ * @see setpriority() in proc.c
+ *
+ * @return 0 on success, -1 if the priority is invalid or
+ * higher than the current one.
+ */
+int sys_setprio(void)
+{
+    int priority;
+    if (argint(0, &priority) < 0) {
+        return -1;
+    }
+    return setpriority(priority);
+}
+
+
+/**
+ * Copies a block of kernel statistics to user space.
+ *
+ * Arguments: int id, void *buf, int n.
+ * id selects the statistics (KSTAT_* in kstat.h), buf is the
+ * user buffer to fill, and n is the buffer's size in bytes.
+ *
+ * @return The number of bytes copied, or -1 if the arguments
+ * are invalid.
+ */
+int sys_kstat(void)
+{
+    int id;
+    int n;
+    char *buf;
+    if (argint(0, &id) < 0 || argint(2, &n) < 0 || n < 0) {
+        return -1;
+    }
+    if (argwptr(1, &buf, n) < 0) {
+        return -1;
+    }
+    switch (id) {
+    case KSTAT_KALLOC:
+        return kallocstat(buf, n);
+    case KSTAT_BCACHE:
+        return bcachestat(buf, n);
+    case KSTAT_DCACHE:
+        return dcachestat(buf, n);
+    case KSTAT_ICACHE:
+        return icachestat(buf, n);
+    default:
+        return -1;
+    }
 }
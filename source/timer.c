@@ -25,7 +25,27 @@
 #define COMPARE2                0x14 // compare 2
 #define COMPARE3                0x18 // compare 3
 
-#define TIMER_FREQ		10000  // interrupt 100 times/sec.
+#define TIMER_FREQ		TICKUS  // interrupt 100 times/sec.
+
+// The system timer counts microseconds, and interrupts when its
+// low word matches a compare register. COMPARE1 gives CPU 0 its
+// scheduling tick, and COMPARE3 the earliest pending deadline.
+// Each tick runs only while its CPU runs a process: a tick which
+// finds the CPU idle is not rearmed, and the scheduler restarts
+// it with tickstart(). So an idle machine takes no interrupts
+// but for the deadlines of sleeping processes.
+
+// Processes sleeping until a time, in a heap by wake-up time.
+static struct {
+	struct spinlock lock;
+	struct proc *heap[NPROC];
+	int n;
+	u_int32 ticks;			// clock ticks, as of tickbase
+	unsigned long long tickbase;	// system time of the last tick counted
+} tq;
+
+static int tickon[NCPU];	// the CPU's scheduling tick is running
+static u_int32 localtimer_tval;
 
 void 
 enabletimer3irq(void)
@@ -33,49 +53,231 @@ enabletimer3irq(void)
         int_ctrl_regs *ip;
 
         ip = (int_ctrl_regs *)INT_REGS_BASE;
-        ip->irq_enable[0] |= 1 << IRQ_TIMER_BIT; // enable the system timer3 irq
+        ip->irq_enable[0] |= 1 << IRQ_TICK_BIT; // the system timer's compare 1
+        ip->irq_enable[0] |= 1 << IRQ_TIMER_BIT; // and compare 3
 }
 
 
 void 
 timer3init(void)
 {
-u_int32 v;
+	initlock(&tq.lock, "timer");
+	tq.tickbase = getsystemtime();
+	tq.ticks = 0;
 
 	enabletimer3irq();
+	tickon[0] = 1;
+	outw(TIMER_REGS_BASE+COMPARE1, inw(TIMER_REGS_BASE+COUNTER_LO) + TIMER_FREQ);
+}
 
-	v = inw(TIMER_REGS_BASE+COUNTER_LO);
-	v += TIMER_FREQ;
+// Swap heap entries i and j.
+static void
+tqswap(int i, int j)
+{
+	struct proc *p;
 
-	outw(TIMER_REGS_BASE+COMPARE3, v);
-	ticks = 0;
+	p = tq.heap[i];
+	tq.heap[i] = tq.heap[j];
+	tq.heap[j] = p;
+	tq.heap[i]->timerslot = i;
+	tq.heap[j]->timerslot = j;
 }
 
+// Move heap entry i up, then down, to its place.
+static void
+tqfix(int i)
+{
+	int c;
+
+	while(i > 0 && tq.heap[i]->wakeat < tq.heap[(i-1)/2]->wakeat){
+		tqswap(i, (i-1)/2);
+		i = (i-1)/2;
+	}
+	while((c = 2*i+1) < tq.n){
+		if(c+1 < tq.n && tq.heap[c+1]->wakeat < tq.heap[c]->wakeat)
+			c++;
+		if(tq.heap[i]->wakeat <= tq.heap[c]->wakeat)
+			break;
+		tqswap(i, c);
+		i = c;
+	}
+}
+
+static void
+tqremove(struct proc *p)
+{
+	int i;
+
+	i = p->timerslot;
+	p->timerslot = -1;
+	if(--tq.n == i)
+		return;
+	tq.heap[i] = tq.heap[tq.n];
+	tq.heap[i]->timerslot = i;
+	tqfix(i);
+}
+
+// Wake the processes whose time has come, and set COMPARE3 for
+// the next. Returns when the compare is set before the counter
+// passes it, so that the interrupt can not be missed.
+// Caller must hold tq.lock.
+static void
+tqrun(void)
+{
+	struct proc *p;
+
+	for(;;){
+		while(tq.n > 0 && tq.heap[0]->wakeat <= getsystemtime()){
+			p = tq.heap[0];
+			tqremove(p);
+			wakeup(&p->wakeat);
+		}
+		if(tq.n == 0)
+			return;
+		outw(TIMER_REGS_BASE+COMPARE3, (u_int32)tq.heap[0]->wakeat);
+		if(tq.heap[0]->wakeat > getsystemtime())
+			return;
+	}
+}
+
+// COMPARE3's interrupt. A deadline more than 2^32 microseconds
+// off matches early, and is set again.
 void 
 timer3intr(void)
 {
-u_int32 v;
-//cprintf("timer3 interrupt: %x\n", inw(TIMER_REGS_BASE+CONTROL_STATUS));
 	outw(TIMER_REGS_BASE+CONTROL_STATUS, (1 << IRQ_TIMER_BIT)); // clear timer3 irq
 
-	ticks++;
-	wakeup(&ticks);
+	acquire(&tq.lock);
+	tqrun();
+	release(&tq.lock);
+}
 
-	// reset the value of compare3
-	v=inw(TIMER_REGS_BASE+COUNTER_LO);
-	v += TIMER_FREQ;
-	outw(TIMER_REGS_BASE+COMPARE3, v);
+// Sleep until the system time reaches when, in microseconds.
+// Returns -1 if the process is killed first, otherwise 0.
+int
+timerwait(unsigned long long when)
+{
+	struct proc *p;
+	int r;
+
+	p = curr_proc;
+	acquire(&tq.lock);
+	p->wakeat = when;
+	p->timerslot = tq.n;
+	tq.heap[tq.n++] = p;
+	tqfix(p->timerslot);
+	if(p->timerslot == 0)
+		tqrun();
+	r = 0;
+	while(p->timerslot >= 0){
+		if(p->killed){
+			tqremove(p);
+			r = -1;
+			break;
+		}
+		sleep(&p->wakeat, &tq.lock);
+	}
+	release(&tq.lock);
+	return r;
+}
+
+// Return the clock ticks since timer3init(), counted
+// from the system time rather than by interrupts.
+u_int32
+timerticks(void)
+{
+	unsigned long long now;
+	u_int32 n;
+
+	acquire(&tq.lock);
+	now = getsystemtime();
+	while(now - tq.tickbase >= TIMER_FREQ){
+		if(now - tq.tickbase > 0x7FFFFFFF)
+			n = 0x7FFFFFFF / TIMER_FREQ;
+		else
+			n = (u_int32)(now - tq.tickbase) / TIMER_FREQ;
+		tq.ticks += n;
+		tq.tickbase += (unsigned long long)n * TIMER_FREQ;
+	}
+	n = tq.ticks;
+	release(&tq.lock);
+	return n;
+}
+
+// Start this CPU's scheduling tick, unless it is running.
+// Called by the scheduler, with interrupts off, before it
+// runs a process.
+void
+tickstart(void)
+{
+	int id;
+
+	id = curr_cpu - cpus;
+	if(tickon[id])
+		return;
+	tickon[id] = 1;
+	if(id == 0)
+		outw(TIMER_REGS_BASE+COMPARE1, inw(TIMER_REGS_BASE+COUNTER_LO) + TIMER_FREQ);
+	else {
+		set_cntp_tval(localtimer_tval);
+		set_cntp_ctl(1);
+	}
+}
+
+// CPU 0's scheduling tick, from COMPARE1. The tick stops
+// if it finds the CPU idle.
+void
+tickintr(void)
+{
+	outw(TIMER_REGS_BASE+CONTROL_STATUS, (1 << IRQ_TICK_BIT));
+	if(curr_proc == 0) {
+		tickon[0] = 0;
+		return;
+	}
+	outw(TIMER_REGS_BASE+COMPARE1, inw(TIMER_REGS_BASE+COUNTER_LO) + TIMER_FREQ);
+}
+
+// Each secondary CPU takes its scheduling tick from its own
+// generic timer; only CPU 0 takes the system timer's interrupts.
+void
+localtimerinit(void)
+{
+	localtimer_tval = get_cntfrq() / 100;  // interrupt 100 times/sec.
+	tickon[curr_cpu - cpus] = 1;
+	set_cntp_tval(localtimer_tval);
+	set_cntp_ctl(1);  // enabled, not masked
+	outw(LOCAL_TIMER_INT_CTRL(curr_cpu->id), LOCAL_IRQ_CNTP);
+}
+
+void
+localtimerintr(void)
+{
+	if(curr_proc == 0) {
+		tickon[curr_cpu - cpus] = 0;
+		set_cntp_ctl(0);  // disabled
+		return;
+	}
+	set_cntp_tval(localtimer_tval);
 }
 
+// Wait m microseconds: by sleeping, if called by a process
+// holding no spinlock, and otherwise (or once the process is
+// killed) by polling the clock.
 void
 delay(u_int32 m)
 {
 	unsigned long long t;
+	int canwait;
 
 	if(m == 0) return;
 
 	t = getsystemtime() + m;
-	while(t != getsystemtime());
+	pushcli();
+	canwait = curr_proc != 0 && curr_cpu->ncli == 1;
+	popcli();
+	if(canwait && timerwait(t) == 0)
+		return;
+	while(getsystemtime() < t);
 
 	return;
 }
@@ -55,24 +55,6 @@ extern u_char8* vectors;
 void set_mode_sp(char* sp, u_int32 cpsr_c);
 
 
-/**
- * The number of times the system clock has 'ticked.'
- *
- * @todo - Move this to timer.c. 'ticks' has nothing to do with the
- * trap implementation.
- */
-u_int32 ticks;
-
-
-/**
- * A lock of the system clock variable 'ticks'.
- *
- * @todo - Move this to timer.c 'ticks_lock' has nothing to do with the
- * trap implementation.
- */
-struct spinlock ticks_lock;
-
-
 /**
  * Enables interrupts from selected sources.
  *
@@ -134,6 +116,18 @@ void tv_init(void)
     memmove(d, s, sizeof(Vpage0));
     dsb_barrier();
     flush_idcache();
+    init_mode_stacks();
+}
+
+
+/**
+ * Initializes the trap mode stacks of the current CPU.
+ *
+ * Each CPU has its own banked stack pointers, so every CPU
+ * must call init_mode_stacks before it enables interrupts.
+ */
+void init_mode_stacks(void)
+{
     /* Allocate stacks and stack pointers. */
     /* FIQ mode. FIQ and IRQ will be disabled. */
     init_mode_stack(0xD1);
@@ -197,7 +191,10 @@ void print_trap(struct trapframe *tf)
  *
  * handle_irq recognises the following IRQ sources:
  * - mini-UART.
- * - System timer.
+ * - System timer: CPU 0's scheduling tick, and deadlines.
+ * - EMMC (SD card) controller.
+ * - DMA engine.
+ * - The generic timer of each secondary CPU.
  *
  * @warning If an IRQ if fired from an unrecognised source, handle_irq
  * will enter an infinite loop. Take care only to enable IRQs which are
@@ -208,21 +205,39 @@ void print_trap(struct trapframe *tf)
  *
  * @todo - add a default case to handel unrecognised interrupts.
  * @param tf - the trap frame generated when the IRQ was fired.
- * @param is_timer_irq - Used to communicate to the caller if the timer
- *                       fired the IRQ.
+ * @param is_timer_irq - Used to communicate to the caller if a scheduling
+ *                       tick fired the IRQ.
  */
 void handle_irq(struct trapframe* tf, u_int32* is_timer_irq)
 {
     int_ctrl_regs* ip;
+    /* Device interrupts are routed to CPU 0. The other CPUs
+     * only take their own generic timer's tick. */
+    if (curr_cpu != &cpus[0]) {
+        if (inw(LOCAL_IRQ_SOURCE(curr_cpu->id)) & LOCAL_IRQ_CNTP) {
+            localtimerintr();
+            *is_timer_irq = 1;
+        }
+        return;
+    }
     ip = (int_ctrl_regs*) INT_REGS_BASE;
     while(ip->irq_pending[0] || ip->irq_pending[1] || ip->irq_basic_pending){
+        if(ip->irq_pending[0] & (1 << IRQ_TICK_BIT)) {
+            tickintr();
+            *is_timer_irq = 1;
+        }
         if(ip->irq_pending[0] & (1 << IRQ_TIMER_BIT)) {
             timer3intr();
-            *is_timer_irq = 1;
-	    }
+        }
         if(ip->irq_pending[0] & (1 << IRQ_MINIUART_BIT)) {
 		    miniuartintr();
         }
+        if(ip->irq_pending[0] & IRQ_DMA_BITS) {
+            dmaintr();
+        }
+        if(ip->irq_pending[1] & (1 << IRQ_EMMC_BIT)) {
+            ideintr();
+        }
 	}
 }
 
@@ -232,7 +247,7 @@ void handle_irq(struct trapframe* tf, u_int32* is_timer_irq)
  *
  * @param tf - The trap frame generated when the system call was fired.
  */
-inline void handle_syscall(struct trapframe* tf)
+static inline void handle_syscall(struct trapframe* tf)
 {
     if(curr_proc->killed) {
         exit();
@@ -246,6 +261,52 @@ inline void handle_syscall(struct trapframe* tf)
 }
 
 
+/**
+ * Handles data aborts caused by touching a page which has not
+ * been mapped yet, or by writing to a copy-on-write page.
+ *
+ * The kernel accesses user memory through user addresses
+ * (for example, read() into a user buffer), so these faults
+ * are resolved whether the abort came from user or kernel
+ * mode. The faulting instruction is re-run when the trap
+ * returns.
+ *
+ * @see pagefault() and cowfault() in vm.c
+ *
+ * @param tf - The trap frame generated when the abort was fired.
+ * @return 0 if the abort was resolved, or -1 otherwise.
+ */
+static int handle_dabt(struct trapframe* tf)
+{
+    u_int32 dfsr;
+    u_int32 va;
+    int r;
+    dfsr = get_dfsr();
+    va = get_dfar();
+    if (curr_proc == 0) {
+        return -1;
+    }
+    switch (DFSR_FS(dfsr)) {
+        case DFSR_FS_TRANS_SECT:
+        case DFSR_FS_TRANS_PAGE:
+            r = pagefault(curr_proc, va);
+            break;
+        case DFSR_FS_PERM_PAGE:
+            r = (dfsr & DFSR_WNR) ? cowfault(curr_proc, va) : -1;
+            break;
+        default:
+            r = -1;
+    }
+    if (r < 0) {
+        return -1;
+    }
+    /* _switchtosvc saves lr - 4 as the return address, but a
+     * data abort's lr is 8 bytes past the faulting instruction. */
+    tf->pc -= 4;
+    return 0;
+}
+
+
 /**
  * Handels unexpected traps by printing error information.
  *
@@ -291,6 +352,18 @@ void trap(struct trapframe *tf)
         case T_IRQ:
 	        handle_irq(tf, &is_timer_irq);
 	        break;
+        case T_DABT:
+            if (handle_dabt(tf) < 0) {
+                handle_bad_trap(tf);
+            }
+            break;
+        case T_PABT:
+            /* The return address saved for a prefetch abort is
+             * already the faulting instruction. */
+            if (curr_proc == 0 || pagefault(curr_proc, tf->ifar) < 0) {
+                handle_bad_trap(tf);
+            }
+            break;
         default:
             handle_bad_trap(tf);
     }
@@ -301,9 +374,9 @@ void trap(struct trapframe *tf)
         if(curr_proc->killed && (tf->spsr&0xF) == PSR_USER_MODE) {
             exit();
         }
-    /* Force process to give up CPU on clock tick.
+    /* Force process to give up CPU once its time slice has run out.
      * If interrupts were on while locks held, would need to check nlock. */
-        if(curr_proc->state == RUNNING && is_timer_irq) {
+        if(curr_proc->state == RUNNING && is_timer_irq && --curr_proc->slice <= 0) {
             yield();
         }
     /* Check if the process has been killed since we yielded. */
@@ -12,6 +12,7 @@
 #include "memlayout.h"
 #include "traps.h"
 #include "arm.h"
+#include "spinlock.h"
 
 #define GPFSEL0			(MMIO_VA+0x200000)
 #define GPFSEL1			(MMIO_VA+0x200004)
@@ -41,6 +42,27 @@
 #define AUX_MU_STAT_REG (MMIO_VA+0x215064)
 #define AUX_MU_BAUD_REG (MMIO_VA+0x215068)
 
+#define AUX_MU_IER_RX	0x1	// receive interrupt enable
+#define AUX_MU_IER_TX	0x2	// transmit FIFO empty interrupt enable
+#define AUX_MU_LSR_RXREADY	0x01	// a byte has been received
+#define AUX_MU_LSR_TXEMPTY	0x20	// the FIFO can take a byte
+
+#define UART_TXBUF	1024	// bytes queued for the transmitter; a power of 2
+
+// Output is queued in a ring, from which the transmit interrupt
+// refills the mini UART's 8 byte FIFO, so writers do not wait
+// for the line. A writer only waits, polling, while the ring is
+// full. uartflush() empties the ring and turns the queue off
+// for panic(), after which output is written synchronously.
+static struct {
+	struct spinlock lock;
+	char buf[UART_TXBUF];
+	u_int32 r;	// bytes taken by the transmitter
+	u_int32 w;	// bytes queued
+	int txintr;	// the transmit interrupt is enabled
+	int sync;	// write synchronously
+} uarttx;
+
 void
 setgpioval(u_int32 pin, u_int32 val)
 {
@@ -78,21 +100,86 @@ setgpiofunc(u_int32 pin, u_int32 func)
 }
 
 
-void 
-uartputc(u_int32 c)
+// Move queued bytes into the transmitter while it has room,
+// and have it interrupt when it is empty only while bytes
+// remain queued. Caller must hold uarttx.lock.
+static void
+uartstart(void)
 {
-	if(c=='\n') {
-		while(1) if(inw(AUX_MU_LSR_REG) & 0x20) break;
-		outw(AUX_MU_IO_REG, 0x0d); // add CR before LF
+	while(uarttx.r != uarttx.w && (inw(AUX_MU_LSR_REG) & AUX_MU_LSR_TXEMPTY))
+		outw(AUX_MU_IO_REG, uarttx.buf[uarttx.r++ % UART_TXBUF]);
+	if((uarttx.r != uarttx.w) != uarttx.txintr) {
+		uarttx.txintr = !uarttx.txintr;
+		outw(AUX_MU_IER_REG, AUX_MU_IER_RX | (uarttx.txintr ? AUX_MU_IER_TX : 0));
 	}
-	while(1) if(inw(AUX_MU_LSR_REG) & 0x20) break;
+}
+
+static void
+uartsyncputc(u_int32 c)
+{
+	while(!(inw(AUX_MU_LSR_REG) & AUX_MU_LSR_TXEMPTY))
+		;
 	outw(AUX_MU_IO_REG, c);
 }
 
+// Queue a byte. Caller must hold uarttx.lock.
+static void
+uartqueue(u_int32 c)
+{
+	while(uarttx.w - uarttx.r == UART_TXBUF)
+		uartstart();	// full: wait for the transmitter
+	uarttx.buf[uarttx.w++ % UART_TXBUF] = c;
+}
+
+// Write n bytes from s, queueing them together.
+void
+uartputs(char *s, int n)
+{
+	int i;
+
+	if(uarttx.sync) {
+		for(i = 0; i < n; i++) {
+			if(s[i]=='\n')
+				uartsyncputc(0x0d);
+			uartsyncputc(s[i] & 0xff);
+		}
+		return;
+	}
+	acquire(&uarttx.lock);
+	for(i = 0; i < n; i++) {
+		if(s[i]=='\n')
+			uartqueue(0x0d); // add CR before LF
+		uartqueue(s[i] & 0xff);
+	}
+	uartstart();
+	release(&uarttx.lock);
+}
+
+void 
+uartputc(u_int32 c)
+{
+	char ch;
+
+	ch = c;
+	uartputs(&ch, 1);
+}
+
+// Write out the queued bytes and turn the queue off, so that
+// later output is written synchronously. Called by panic():
+// uarttx.lock is not taken, since the panicking CPU may hold it.
+void
+uartflush(void)
+{
+	uarttx.sync = 1;
+	while(uarttx.r != uarttx.w)
+		uartsyncputc(uarttx.buf[uarttx.r++ % UART_TXBUF]);
+	outw(AUX_MU_IER_REG, AUX_MU_IER_RX);
+}
+
 static int
 uartgetc(void)
 {
-	if(inw(AUX_MU_LSR_REG)&0x1) return inw(AUX_MU_IO_REG);
+	if(inw(AUX_MU_LSR_REG)&AUX_MU_LSR_RXREADY) return inw(AUX_MU_IO_REG);
 	else return -1;
 }
 
@@ -106,20 +193,29 @@ enableirqminiuart(void)
 }
 
 
+// Interrupt handler, for received bytes and for
+// the transmitter emptying its FIFO.
 void
 miniuartintr(void)
 {
-  consoleintr(uartgetc);
+	if(inw(AUX_MU_LSR_REG) & AUX_MU_LSR_RXREADY)
+		consoleintr(uartgetc);
+	if(uarttx.sync)
+		return;
+	acquire(&uarttx.lock);
+	uartstart();
+	release(&uarttx.lock);
 }
 
 void 
 uartinit(void)
 {
+	initlock(&uarttx.lock, "uart");
 	outw(AUX_ENABLES, 1);
 	outw(AUX_MU_CNTL_REG, 0);
 	outw(AUX_MU_LCR_REG, 0x3);
 	outw(AUX_MU_MCR_REG, 0);
-	outw(AUX_MU_IER_REG, 0x1);
+	outw(AUX_MU_IER_REG, AUX_MU_IER_RX);
 	outw(AUX_MU_IIR_REG, 0xC7);
 	outw(AUX_MU_BAUD_REG, 270); // (250,000,000/(115200*8))-1 = 270
 
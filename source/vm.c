@@ -15,6 +15,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
 
 extern char data[];  // defined by kernel.ld
 extern char kernel_bin_end[];  // defined by kernel.ld
@@ -35,10 +36,9 @@ walkpgdir(pde_t *pgdir, const void *va, u_int32 l1attr, int alloc)
   if((u_int32)*pde != 0){
     pgtab = (pte_t*)p2v(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // kzalloc makes sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -117,7 +117,7 @@ static struct kmap {
   u_int32 l1attr;
   u_int32 l2attr;
 } kmap[] = {
- { (void*)KERNBASE, PHYSTART, PHYSTOP, PDX_ATRB_DOMAIN0|PDX_ATRB_AP(PTX_ATRB_URW)|PDX_ATRB_SECTION_ENTRY|PTX_ATRB_CACHED|PTX_ATRB_BUFFERED, 0},
+ { (void*)KERNBASE, PHYSTART, PHYSTOP, PDX_ATRB_DOMAIN0|PDX_ATRB_AP(PTX_ATRB_URW)|PDX_ATRB_SECTION_ENTRY|PDX_ATRB_KMEM, 0},
  { (void*)MMIO_VA, MMIO_PA, MMIO_PA+MMIO_SIZE, PDX_ATRB_DOMAIN0|PDX_ATRB_AP(PTX_ATRB_URW)|PDX_ATRB_SECTION_ENTRY, 0},
  { (void*)HVECTORS, PHYSTART, PHYSTART+TVSIZE, PDX_ATRB_DOMAIN0|PDX_ATRB_PTX_ENTRY, PTX_ATRB_AP(PTX_ATRB_KRW)|PTX_ATRB_SMALL},
 };
@@ -131,11 +131,9 @@ setupkvm(void)
 {
   pde_t *pgdir;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
 //cprintf("inside setupkvm: pgdir=%x\n", pgdir);
-  memset(pgdir, 0, PGSIZE);
-//cprintf("after memset\n", pgdir);
   return pgdir;
 }
 
@@ -171,13 +169,88 @@ kvmalloc(void)
   switchkvm();
 }
 
+// ASID allocator. Each process runs with its own ASID so its
+// (non-global) TLB entries survive context switches. ASIDs are
+// handed out in generations: when the ASID_BITS space is used up
+// a new generation starts, every CPU flushes its TLB once, and
+// processes holding an ASID from an older generation are given a
+// fresh one the next time they are switched to.
+static struct {
+  struct spinlock lock;
+  u_int32 generation;  // current generation, above ASID_MASK
+  u_int32 next;        // next unused ASID in this generation
+} asids;
+
+// Start the ASID allocator, and split the boot CPU's
+// address space (see kvmcpuinit).
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+  asids.generation = ASID_MASK + 1;
+  asids.next = 1;
+  kvmcpuinit();
+}
+
+// Split this CPU's address space between TTBR0 (user, below
+// USERBOUND) and TTBR1 (kernel_page_dir). TTBR0 walks stay
+// disabled until a process is switched to. Run by every CPU.
+void
+kvmcpuinit(void)
+{
+  set_ttbr1(v2p(kernel_page_dir) | TTBR_ATRB);
+  set_ttbcr(TTBCR_PD0 | TTBCR_N_USER);
+  flush_tlb();
+}
+
+// Return p's ASID, allocating one from the current generation
+// if p does not hold one. Called with interrupts disabled.
+static u_int32
+asidget(struct proc *p)
+{
+  struct cpu *c;
+
+  acquire(&asids.lock);
+  if((p->context_id & ~ASID_MASK) != asids.generation){
+    if(asids.next > ASID_MASK){
+      asids.generation += ASID_MASK + 1;
+      if(asids.generation == 0)
+        asids.generation = ASID_MASK + 1;
+      asids.next = 1;
+      for(c = cpus; c < &cpus[NCPU]; c++)
+        c->asid_flush = 1;
+    }
+    p->context_id = asids.generation | asids.next++;
+  }
+  release(&asids.lock);
+  if(curr_cpu->asid_flush){
+    curr_cpu->asid_flush = 0;
+    flush_tlb();
+  }
+  return p->context_id & ASID_MASK;
+}
+
+// Drop the TLB entries of p's address space, after its user
+// mappings have been removed or its page directory replaced.
+// The ASID is flushed even if another CPU has since started a
+// new generation: p may still be running with entries tagged
+// with it, and if the ASID now belongs to another process,
+// flushing it only costs that process some TLB misses.
+void
+flushuvm(struct proc *p)
+{
+  pushcli();
+  flush_tlb_asid(p->context_id & ASID_MASK);
+  popcli();
+}
+
 // Switch h/w page table register to the kernel-only page table,
-// for when no process is running.
+// for when no process is running. Kernel addresses are translated
+// through TTBR1, so this only has to stop TTBR0 walks.
 void
 switchkvm(void)
 {
-// do nothing here as the same pgdir is shared between kernel and user;
-// will see if the user portion of the pgdir should be removed.
+  set_ttbcr(TTBCR_PD0 | TTBCR_N_USER);
 }
 
 void
@@ -193,22 +266,33 @@ switchkvm_new(void)
   //cprintf("after flush_tlb\n");
 }
 
-// Switch TSS and h/w page table to correspond to process p.
+// Switch h/w page table to correspond to process p.
+// p's page directory is installed in TTBR0 with p's ASID, so
+// neither the caches nor the TLB need to be flushed.
 void
 switchuvm(struct proc *p)
 {
+  u_int32 asid;
+
   pushcli();
-  //cpu->ts.esp0 = (u_int32)proc->kstack + KSTACKSIZE;
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
-//cprintf("before copying uvm to kvm kernel_page_dir=%x the first entry: %x\n", kernel_page_dir, kernel_page_dir[0]);
-  memmove((void *)kernel_page_dir, (void *)p->pgdir, PGSIZE);  // switch to new user address space
-  flush_idcache();
-  flush_tlb();
+  asid = asidget(p);
+  set_ttbr0_asid(v2p(p->pgdir) | TTBR_ATRB, asid);
   popcli();
 }
 
 
+// Write a user page the kernel filled back to memory. The
+// I-cache is off, so instruction fetches bypass the D-cache
+// and would otherwise miss text still dirty in it.
+static void
+flushtext(char *mem)
+{
+  flush_dcache((u_int32)mem, (u_int32)mem + PGSIZE);
+  flush_idcache();
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -218,39 +302,13 @@ inituvm(pde_t *pgdir, char *init, u_int32 sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
 //cprintf("inituvm: page is allocated at %x\n", mem);
   mappages(pgdir, 0, PGSIZE, v2p(mem), UVM_PDX_ATRB, UVM_PTX_ATRB);
   //mappages(pgdir, 0, PGSIZE, v2p(mem), UVM_PDX_ATRB, 0xdfe);
 
   memmove(mem, init, sz);
-}
-
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, u_int32 offset, u_int32 sz)
-{
-  u_int32 i, pa, n;
-  pte_t *pte;
-
-  if((u_int32) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  if((u_int32)addr + sz > USERBOUND)
-    panic("loaduvm: user address space exceeds the allowed space (> 0x80000000)");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, UVM_PDX_ATRB, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, p2v(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
+  flushtext(mem);
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
@@ -268,13 +326,12 @@ allocuvm(pde_t *pgdir, u_int32 oldsz, u_int32 newsz)
 
   a = PG_ROUND_UP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     mappages(pgdir, (char*)a, PGSIZE, v2p(mem), UVM_PDX_ATRB, UVM_PTX_ATRB);
     //mappages(pgdir, (char*)a, PGSIZE, v2p(mem), UVM_PDX_ATRB, 0xdfe);
   }
@@ -298,7 +355,7 @@ deallocuvm(pde_t *pgdir, u_int32 oldsz, u_int32 newsz)
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, UVM_PDX_ATRB, 0);
     if(!pte)
-      a += (N_PT_ENTRIES - 1) * PGSIZE;
+      a |= MBYTE - PGSIZE;  // skip to the next page table
     else if(*pte != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
@@ -340,11 +397,17 @@ clearpteu(pde_t *pgdir, char *uva)
   pte = walkpgdir(pgdir, uva, UVM_PDX_ATRB, 0);
   if(pte == 0)
     panic("clearpteu");
-  *pte &= ~PTX_ATRB_AP(PTX_ATRB_UAP);
+  // Keep the page non-global, so its kernel-only TLB entry
+  // cannot match in another address space.
+  *pte = (*pte & ~PTX_ATRB_AP(PTX_ATRB_UAP)) | PTX_ATRB_nG;
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. User pages are not copied: parent and
+// child share them read-only (UVM_PTX_COW) until one of them
+// writes, when cowfault() gives the writer a private copy.
+// The caller must flush the parent's TLB entries, which may
+// still allow writes to the shared pages.
 pde_t*
 copyuvm(pde_t *pgdir, u_int32 sz)
 {
@@ -356,17 +419,32 @@ copyuvm(pde_t *pgdir, u_int32 sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, UVM_PDX_ATRB, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    // Pages not touched yet stay untouched in the child.
+    if((pte = walkpgdir(pgdir, (void *) i, UVM_PDX_ATRB, 0)) == 0){
+      i |= MBYTE - PGSIZE;  // skip to the next page table
+      continue;
+    }
     if((u_int32)*pte == 0)
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if(flags == UVM_PTX_ATRB || flags == UVM_PTX_COW){
+      if(mappages(d, (void*)i, PGSIZE, pa, UVM_PDX_ATRB, UVM_PTX_COW) < 0)
+        goto bad;
+      kdup(p2v(pa));
+      *pte = pa | UVM_PTX_COW;
+      continue;
+    }
+    // Other pages, such as the stack guard page, are not
+    // user writable and are copied as before.
     if((mem = kalloc()) == 0)
       goto bad;
-    memmove(mem, (char*)p2v(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, v2p(mem), UVM_PDX_ATRB, flags) < 0)
+    if(dmacopy(mem, (char*)p2v(pa), PGSIZE) < 0)
+      memmove(mem, (char*)p2v(pa), PGSIZE);
+    if(mappages(d, (void*)i, PGSIZE, v2p(mem), UVM_PDX_ATRB, flags) < 0){
+      kfree(mem);
       goto bad;
+    }
   }
   return d;
 
@@ -375,6 +453,144 @@ bad:
   return 0;
 }
 
+// Resolve a write fault by p at user address va on a page
+// shared copy-on-write. The last owner of a page takes it
+// over; otherwise the page is copied. Returns 0 if the
+// fault was resolved, -1 if va is not a COW page or there
+// is no memory for the copy.
+int
+cowfault(struct proc *p, u_int32 va)
+{
+  pte_t *pte;
+  u_int32 pa;
+  char *mem;
+
+  if(va >= p->sz)
+    return -1;
+  pte = walkpgdir(p->pgdir, (void*)va, UVM_PDX_ATRB, 0);
+  if(pte == 0 || PTE_FLAGS(*pte) != UVM_PTX_COW)
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcnt(p2v(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    if(dmacopy(mem, (char*)p2v(pa), PGSIZE) < 0)
+      memmove(mem, (char*)p2v(pa), PGSIZE);
+    flushtext(mem);  // the page may hold text as well as data
+    *pte = v2p(mem) | UVM_PTX_ATRB;
+    kfree(p2v(pa));
+  } else {
+    *pte = pa | UVM_PTX_ATRB;
+  }
+  pushcli();
+  flush_tlb_page(va, p->context_id & ASID_MASK);
+  popcli();
+  return 0;
+}
+
+// Map the page *pg at user address va of p, in place of the
+// page mapped there, which is handed back through *pg. Lets a
+// whole page of data reach a process without being copied.
+// Returns -1, changing nothing, unless va is a private,
+// writable page of p's memory.
+int
+pageflip(struct proc *p, u_int32 va, char **pg)
+{
+  pte_t *pte;
+  char *old;
+
+  if(va >= p->sz || va % PGSIZE != 0)
+    return -1;
+  pte = walkpgdir(p->pgdir, (void*)va, UVM_PDX_ATRB, 0);
+  if(pte == 0 || PTE_FLAGS(*pte) != UVM_PTX_ATRB)
+    return -1;
+  old = p2v(PTE_ADDR(*pte));
+  *pte = v2p(*pg) | UVM_PTX_ATRB;
+  pushcli();
+  flush_tlb_page(va, p->context_id & ASID_MASK);
+  popcli();
+  *pg = old;
+  return 0;
+}
+
+// Map the page of p's memory containing va, which has not
+// been touched since sbrk() or exec() reserved it. The parts
+// of the page in one of p's loadable segments are read from
+// its executable, and the rest is zeroed. Reading may sleep,
+// so the caller must not hold a spinlock. Returns 0 on
+// success, -1 if va is outside p's memory or already mapped,
+// or the page can not be allocated or read.
+int
+pagefault(struct proc *p, u_int32 va)
+{
+  struct vmseg *s;
+  pte_t *pte;
+  u_int32 a, lo, hi;
+  char *mem;
+  int loaded;
+
+  if(va >= p->sz)
+    return -1;
+  a = PG_ROUND_DOWN(va);
+  pte = walkpgdir(p->pgdir, (void*)a, UVM_PDX_ATRB, 0);
+  if(pte != 0 && (u_int32)*pte != 0)
+    return -1;
+  if((mem = kzalloc()) == 0)
+    return -1;
+  loaded = 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    lo = s->va > a ? s->va : a;
+    hi = s->va + s->filesz < a + PGSIZE ? s->va + s->filesz : a + PGSIZE;
+    if(lo >= hi)
+      continue;
+    if(curr_cpu->ncli > 0)
+      panic("pagefault: holding locks");
+    ilock(p->exe);
+    if(readi(p->exe, mem + (lo - a), s->off + (lo - s->va), hi - lo) != hi - lo){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->exe);
+    loaded = 1;
+  }
+  if(mappages(p->pgdir, (void*)a, PGSIZE, v2p(mem), UVM_PDX_ATRB, UVM_PTX_ATRB) < 0){
+    kfree(mem);
+    return -1;
+  }
+  // Text written through the kernel's mapping must reach
+  // memory before it is fetched through the user's.
+  if(loaded)
+    flushtext(mem);
+  dsb_barrier();
+  return 0;
+}
+
+// Map every untouched page of p's memory in [va, va+n), so
+// the kernel can access the range while holding spinlocks.
+// If write is set, also give p its own copy of every page in
+// the range shared copy-on-write, so the kernel can write it.
+// Returns 0 on success, -1 if a page could not be mapped or
+// copied.
+int
+prefaultuvm(struct proc *p, u_int32 va, u_int32 n, int write)
+{
+  pte_t *pte;
+  u_int32 a;
+
+  for(a = PG_ROUND_DOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (void*)a, UVM_PDX_ATRB, 0);
+    if(pte == 0 || (u_int32)*pte == 0){
+      if(pagefault(p, a) < 0)
+        return -1;
+    } else if(write && PTE_FLAGS(*pte) == UVM_PTX_COW){
+      if(cowfault(p, a) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -383,7 +599,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, UVM_PDX_ATRB, 0);
-  if((u_int32)*pte == 0)
+  if(pte == 0 || (u_int32)*pte == 0)
     return 0;
   if(((u_int32)*pte & PTX_ATRB_AP(PTX_ATRB_UAP)) == 0)
     return 0;
@@ -0,0 +1,151 @@
+// divbench: checks the kernel's software division (source/div.c)
+// against the hardware divider, then times both.
+//
+// Runs on an ARM Linux host whose core has UDIV, such as
+// Raspbian on a Pi 2:
+//
+//   make divbench && ./divbench [iterations]
+//
+// The check tries random numerators with small, large and power
+// of two divisors. The benchmark reports CPU cycles per division
+// from the perf cycle counter, or nanoseconds where that is
+// unavailable, for each kind of divisor.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+unsigned int k_div(unsigned int n, unsigned int d);
+
+#define NDIV 4096
+
+static unsigned int num[NDIV], den[NDIV];
+
+static unsigned int
+rand32(void)
+{
+  return (unsigned int)rand() << 16 ^ rand();
+}
+
+// A divisor of the given kind.
+static unsigned int
+divisor(int kind)
+{
+  unsigned int d;
+
+  switch(kind){
+  case 0:  d = rand() % 64; break;            // small, as in 2*hz
+  case 1:  d = rand32() >> (rand() % 32); break;
+  default: d = 1u << (rand() % 32); break;    // as in BSIZE, PGSIZE
+  }
+  return d ? d : 1;
+}
+
+static void
+fuzz(long iters)
+{
+  unsigned int n, d;
+  long i;
+
+  for(i = 0; i < iters; i++){
+    n = rand32() >> (rand() % 32);
+    d = divisor(i % 3);
+    if(k_div(n, d) != n / d){
+      printf("divbench: div(%u, %u) = %u, not %u\n", n, d, k_div(n, d), n / d);
+      exit(1);
+    }
+  }
+}
+
+static int perffd = -1;
+
+static void
+counterinit(void)
+{
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CPU_CYCLES;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  perffd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+  if(perffd >= 0)
+    ioctl(perffd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// Cycles, or nanoseconds without a cycle counter.
+static unsigned long long
+counter(void)
+{
+  unsigned long long v;
+  struct timespec ts;
+
+  if(perffd >= 0 && read(perffd, &v, sizeof(v)) == sizeof(v))
+    return v;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Divide with UDIV, out of line like k_div, so that
+// the compiler does not move divisions out of the loop.
+static unsigned int __attribute__((noinline))
+hw_div(unsigned int n, unsigned int d)
+{
+  return n / d;
+}
+
+static void
+bench(void)
+{
+  static char *kinds[] = { "small", "large", "pow2" };
+  unsigned long long t0, t1, t2;
+  unsigned int i, sum;
+  int kind, r, reps;
+
+  counterinit();
+  printf("%-8s %12s %12s\n", "divisor",
+         perffd >= 0 ? "div cycles" : "div ns",
+         perffd >= 0 ? "udiv cycles" : "udiv ns");
+  reps = 64;
+  sum = 0;
+  for(kind = 0; kind < 3; kind++){
+    for(i = 0; i < NDIV; i++){
+      num[i] = rand32();
+      den[i] = divisor(kind);
+    }
+    t0 = counter();
+    for(r = 0; r < reps; r++)
+      for(i = 0; i < NDIV; i++)
+        sum += k_div(num[i], den[i]);
+    t1 = counter();
+    for(r = 0; r < reps; r++)
+      for(i = 0; i < NDIV; i++)
+        sum += hw_div(num[i], den[i]);
+    t2 = counter();
+    printf("%-8s %12llu %12llu\n", kinds[kind],
+           (t1 - t0) / (reps * NDIV), (t2 - t1) / (reps * NDIV));
+  }
+  if(sum == 1)
+    printf("\n");  // use sum
+}
+
+int
+main(int argc, char *argv[])
+{
+  long iters;
+
+  iters = argc > 1 ? atol(argv[1]) : 1000000;
+  srand(time(0));
+  fuzz(iters);
+  printf("divbench: %ld random cases OK\n", iters);
+  bench();
+  return 0;
+}
@@ -0,0 +1,223 @@
+// memfuzz: checks the kernel's assembly memmove/memset/memcmp
+// (source/memfunc.S) against simple byte loops, then times both.
+//
+// Runs on an ARM Linux host, such as Raspbian on the Pi itself:
+//
+//   make memfuzz && ./memfuzz [iterations]
+//
+// The fuzzer tries random lengths and source/destination
+// offsets, including overlapping moves, and checks the results,
+// return values, and that no byte outside the block changed.
+// The benchmark reports CPU cycles per call from the perf
+// cycle counter, or nanoseconds where that is unavailable.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+void *k_memmove(void *dst, const void *src, unsigned int n);
+void *k_memcpy(void *dst, const void *src, unsigned int n);
+void *k_memset(void *dst, int c, unsigned int n);
+int k_memcmp(const void *v1, const void *v2, unsigned int n);
+
+#define BUFSZ 8192
+#define GUARD 64
+
+static unsigned char buf[BUFSZ], ref[BUFSZ];
+
+static void
+ref_memmove(unsigned char *d, const unsigned char *s, unsigned int n)
+{
+  if(s < d && s + n > d)
+    while(n-- > 0)
+      d[n] = s[n];
+  else
+    while(n-- > 0)
+      *d++ = *s++;
+}
+
+static void
+ref_memset(unsigned char *d, int c, unsigned int n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static int
+ref_memcmp(const unsigned char *a, const unsigned char *b, unsigned int n)
+{
+  for(; n > 0; n--, a++, b++)
+    if(*a != *b)
+      return *a - *b;
+  return 0;
+}
+
+static void
+fill(void)
+{
+  int i;
+
+  for(i = 0; i < BUFSZ; i++)
+    buf[i] = ref[i] = rand();
+}
+
+static void
+fail(char *what, unsigned int d, unsigned int s, unsigned int n)
+{
+  printf("memfuzz: %s failed: dst +%u src +%u n %u\n", what, d, s, n);
+  exit(1);
+}
+
+static unsigned int
+randlen(void)
+{
+  // Mostly short blocks, where the head and tail fixups matter.
+  switch(rand() % 4){
+  case 0:  return rand() % 16;
+  case 1:  return rand() % 128;
+  case 2:  return rand() % 1024;
+  default: return rand() % (BUFSZ / 2 - 2*GUARD);
+  }
+}
+
+static void
+fuzz(long iters)
+{
+  unsigned int d, s, n;
+  long i;
+  int c, r;
+
+  for(i = 0; i < iters; i++){
+    n = randlen();
+    d = GUARD + rand() % (BUFSZ - n - 2*GUARD);
+    // Half the moves overlap their source.
+    if(rand() % 2)
+      s = GUARD + rand() % (BUFSZ - n - 2*GUARD);
+    else
+      s = d + (rand() % 65) - 32;
+    if(s < GUARD || s + n > BUFSZ - GUARD)
+      s = d;
+
+    fill();
+    if(k_memmove(buf + d, buf + s, n) != buf + d)
+      fail("memmove return", d, s, n);
+    ref_memmove(ref + d, ref + s, n);
+    if(memcmp(buf, ref, BUFSZ) != 0)
+      fail("memmove", d, s, n);
+
+    fill();
+    c = rand();
+    if(k_memset(buf + d, c, n) != buf + d)
+      fail("memset return", d, s, n);
+    memset(ref + d, c, n);
+    if(memcmp(buf, ref, BUFSZ) != 0)
+      fail("memset", d, s, n);
+
+    fill();
+    ref_memmove(buf + s, buf + d, n);
+    if(n > 0 && rand() % 2)
+      buf[s + rand() % n] ^= 1 << (rand() % 8);
+    r = k_memcmp(buf + d, buf + s, n);
+    c = ref_memcmp(buf + d, buf + s, n);
+    if((r < 0) != (c < 0) || (r > 0) != (c > 0))
+      fail("memcmp", d, s, n);
+  }
+}
+
+static int perffd = -1;
+
+static void
+counterinit(void)
+{
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CPU_CYCLES;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  perffd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+  if(perffd >= 0)
+    ioctl(perffd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// Cycles, or nanoseconds without a cycle counter.
+static unsigned long long
+counter(void)
+{
+  unsigned long long v;
+  struct timespec ts;
+
+  if(perffd >= 0 && read(perffd, &v, sizeof(v)) == sizeof(v))
+    return v;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench(void)
+{
+  static unsigned int lens[] = { 16, 64, 512, 4096 };
+  unsigned long long t0, t1, t2;
+  unsigned int i, j, n, off;
+  int reps;
+
+  counterinit();
+  printf("%-8s %5s %4s %12s %12s\n", "routine", "n", "off",
+         perffd >= 0 ? "asm cycles" : "asm ns",
+         perffd >= 0 ? "c cycles" : "c ns");
+  for(i = 0; i < sizeof(lens)/sizeof(lens[0]); i++){
+    for(off = 0; off < 2; off++){
+      n = lens[i];
+      reps = 1 << 20 >> (i * 2);
+      t0 = counter();
+      for(j = 0; j < reps; j++)
+        k_memmove(buf + off, buf + BUFSZ/2, n);
+      t1 = counter();
+      for(j = 0; j < reps; j++)
+        ref_memmove(buf + off, buf + BUFSZ/2, n);
+      t2 = counter();
+      printf("%-8s %5u %4u %12llu %12llu\n", "memmove", n, off,
+             (t1 - t0) / reps, (t2 - t1) / reps);
+    }
+    t0 = counter();
+    for(j = 0; j < reps; j++)
+      k_memset(buf, j, n);
+    t1 = counter();
+    for(j = 0; j < reps; j++)
+      ref_memset(buf, j, n);
+    t2 = counter();
+    printf("%-8s %5u %4u %12llu %12llu\n", "memset", n, 0,
+           (t1 - t0) / reps, (t2 - t1) / reps);
+    memmove(buf + BUFSZ/2, buf, n);
+    t0 = counter();
+    for(j = 0; j < reps; j++)
+      k_memcmp(buf, buf + BUFSZ/2, n);
+    t1 = counter();
+    for(j = 0; j < reps; j++)
+      ref_memcmp(buf, buf + BUFSZ/2, n);
+    t2 = counter();
+    printf("%-8s %5u %4u %12llu %12llu\n", "memcmp", n, 0,
+           (t1 - t0) / reps, (t2 - t1) / reps);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  long iters;
+
+  iters = argc > 1 ? atol(argv[1]) : 200000;
+  srand(time(0));
+  fuzz(iters);
+  printf("memfuzz: %ld random cases OK\n", iters);
+  bench();
+  return 0;
+}
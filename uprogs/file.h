@@ -1,3 +1,10 @@
+// Sequential read detection and readahead, for ireadahead().
+struct rastate {
+  uint next;  // offset at which a sequential read would start
+  uint win;   // readahead window in blocks, 0 if not sequential
+  uint end;   // offset up to which blocks have been read ahead
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
   int ref; // reference count
@@ -6,6 +13,7 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  struct rastate ra;
 };
 
 
@@ -15,13 +23,19 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  int nexec;          // processes running it as p->exe
+  int nwrite;         // open files that may write it
+  uint bhint;      // next block balloc() should try for it
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // icache LRU list, while ref is 0
+  struct inode *next;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
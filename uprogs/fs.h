@@ -9,7 +9,12 @@
 // Then sb.nlog log blocks.
 
 #define ROOTINO 1  // root i-number
+// The block size is fixed when the kernel and mkfs are built,
+// by make bsize=1024 (or 2048, 4096), and mkfs records it in
+// the superblock.
+#ifndef BSIZE
 #define BSIZE 512  // block size
+#endif
 
 // File system super block
 struct superblock {
@@ -17,11 +22,13 @@ struct superblock {
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
+  uint bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -30,7 +37,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
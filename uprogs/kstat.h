@@ -0,0 +1,39 @@
+// Kernel statistics exported through the kstat system call.
+
+#define KSTAT_KALLOC 1  // struct kallocstat[NCPU]
+#define KSTAT_BCACHE 2  // struct bcachestat
+#define KSTAT_DCACHE 3  // struct dcachestat
+#define KSTAT_ICACHE 4  // struct icachestat
+
+// Per-CPU page allocator counters.
+struct kallocstat {
+  uint hits;    // kalloc() served from the CPU's page cache
+  uint misses;  // kalloc() that refilled from the global freelist
+  uint zeroed;  // kzalloc() served from pages zeroed while idle
+  uint cached;  // pages currently held by the CPU
+};
+
+// Buffer cache counters.
+struct bcachestat {
+  uint nbuf;    // buffers in the cache
+  uint hits;    // bget() found the block cached
+  uint misses;  // bget() had to find a buffer for the block
+  uint evicts;  // misses that recycled a buffer holding another block
+  uint aheads;  // blocks read ahead by breadahead()
+};
+
+// Directory entry cache counters.
+struct dcachestat {
+  uint nent;    // entries in the cache
+  uint hits;    // dirlookup() found the name cached
+  uint neghits; // dirlookup() found the name cached as absent
+  uint misses;  // dirlookup() had to scan the directory
+};
+
+// Inode cache counters.
+struct icachestat {
+  uint ninode;  // entries in the cache
+  uint hits;    // iget() found the inode cached
+  uint misses;  // iget() had to find an entry for the inode
+  uint evicts;  // misses that recycled an entry holding another inode
+};
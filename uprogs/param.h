@@ -1,12 +1,18 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      1024  // maximum number of processes
+#define NPRIO         4  // scheduling priority levels
+#define TIMESLICE     1  // clock ticks a process runs before preemption
+#define TICKUS    10000  // microseconds per clock tick
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NBUF         10  // minimum size of disk block cache
+#define NINODE       50  // minimum size of inode cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define LOGSIZE      10  // max data sectors in on-disk log
+#define NSEG          4  // max loadable ELF segments per process
+#define MAXOPBLOCKS  12  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*3)  // data sectors in on-disk log made by mkfs
+#define FSSIZE     2048  // blocks in the file system image made by mkfs
 
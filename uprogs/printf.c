@@ -2,35 +2,65 @@
 #include "stat.h"
 #include "user.h"
 
+// printf() gathers its output in a buffer, and writes it with
+// one system call per call, or per buffer filled.
+struct pbuf {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+static void
+flush(struct pbuf *b)
+{
+  if(b->n > 0)
+    write(b->fd, b->buf, b->n);
+  b->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct pbuf *b, char c)
 {
-  write(fd, &c, 1);
+  b->buf[b->n++] = c;
+  if(b->n == sizeof(b->buf))
+    flush(b);
 }
 
-u32 div(u32 n, u32 d)  // long division
+// Long division, one step per bit of the quotient. User
+// programs are built for plain ARMv7-A, which has no UDIV.
+// See div() in the kernel's div.c.
+u32 div(u32 n, u32 d)
 {
-    u32 q=0, r=0;
+    u32 q=0;
     int i;
 
-    for(i=31;i>=0;i--){
-        r = r << 1;
-        r = r | ((n >> i) & 1);
-        if(r >= d) {
-            r = r - d;
-            q = q | (1 << i);
+    if(d == 0 || n < d)
+        return 0;
+    if((d & (d - 1)) == 0)
+        return n >> __builtin_ctz(d);
+    i = __builtin_clz(d) - __builtin_clz(n);
+    d = d << i;
+    for(; i >= 0; i--){
+        q = q << 1;
+        if(n >= d) {
+            n = n - d;
+            q = q | 1;
         }
+        d = d >> 1;
     }
     return q;
 }
 
+// Digits are found without div(): in hex by shifts, and in
+// decimal by multiplying by 2^35/10, rounded up, which gives
+// the exact quotient for any 32-bit x.
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct pbuf *pb, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
   int i, neg;
-  uint x, y, b;
+  uint x, y;
 
   neg = 0;
   if(sgn && xx < 0){
@@ -40,27 +70,35 @@ printint(int fd, int xx, int base, int sgn)
     x = xx;
   }
 
-  b = base;
   i = 0;
   do{
-    y = div(x, b);
-    buf[i++] = digits[x - y * b];
-  }while((x = y) != 0);
+    if(base == 16){
+      buf[i++] = digits[x & 0xF];
+      x >>= 4;
+    } else {
+      y = ((u64)x * 0xCCCCCCCDU) >> 35;
+      buf[i++] = digits[x - y * 10];
+      x = y;
+    }
+  }while(x != 0);
   if(neg)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(pb, buf[i]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 printf(int fd, char *fmt, ...)
 {
+  struct pbuf pb;
   char *s;
   int c, i, state;
   uint *ap;
 
+  pb.fd = fd;
+  pb.n = 0;
   state = 0;
   ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
@@ -69,14 +107,14 @@ printf(int fd, char *fmt, ...)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(&pb, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(&pb, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(&pb, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -84,20 +122,21 @@ printf(int fd, char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(&pb, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(&pb, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(&pb, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(&pb, '%');
+        putc(&pb, c);
       }
       state = 0;
     }
   }
+  flush(&pb);
 }
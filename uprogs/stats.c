@@ -0,0 +1,76 @@
+// Print kernel statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "kstat.h"
+
+void
+kallocstats(void)
+{
+  struct kallocstat st[NCPU];
+  int i, n;
+
+  n = kstat(KSTAT_KALLOC, st, sizeof(st));
+  if(n < 0){
+    printf(2, "stats: kalloc stats unavailable\n");
+    return;
+  }
+  printf(1, "kalloc: cpu hits misses zeroed cached\n");
+  for(i = 0; i < n / sizeof(st[0]); i++){
+    if(st[i].hits + st[i].misses + st[i].cached == 0)
+      continue;
+    printf(1, "kalloc: %d %d %d %d %d\n", i,
+           st[i].hits, st[i].misses, st[i].zeroed, st[i].cached);
+  }
+}
+
+void
+bcachestats(void)
+{
+  struct bcachestat st;
+
+  if(kstat(KSTAT_BCACHE, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "stats: bcache stats unavailable\n");
+    return;
+  }
+  printf(1, "bcache: %d bufs, %d hits, %d misses, %d evicts, %d read ahead\n",
+         st.nbuf, st.hits, st.misses, st.evicts, st.aheads);
+}
+
+void
+dcachestats(void)
+{
+  struct dcachestat st;
+
+  if(kstat(KSTAT_DCACHE, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "stats: dcache stats unavailable\n");
+    return;
+  }
+  printf(1, "dcache: %d entries, %d hits, %d negative hits, %d misses\n",
+         st.nent, st.hits, st.neghits, st.misses);
+}
+
+void
+icachestats(void)
+{
+  struct icachestat st;
+
+  if(kstat(KSTAT_ICACHE, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "stats: icache stats unavailable\n");
+    return;
+  }
+  printf(1, "icache: %d inodes, %d hits, %d misses, %d evicts\n",
+         st.ninode, st.hits, st.misses, st.evicts);
+}
+
+int
+main(void)
+{
+  kallocstats();
+  bcachestats();
+  dcachestats();
+  icachestats();
+  exit();
+}
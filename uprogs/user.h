@@ -22,6 +22,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int kstat(int, void*, int);
+int setprio(int);
+int usleep(int);
 
 // ulib.c
 int stat(char*, struct stat*);
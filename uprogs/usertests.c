@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "kstat.h"
 
 char buf[8192];
 char name[3];
@@ -97,7 +98,9 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  // MAXFILE blocks no longer fit on the disk;
+  // fill the direct and indirect blocks.
+  for(i = 0; i < NDIRECT + NINDIRECT; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -117,7 +120,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NDIRECT + NINDIRECT){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -324,6 +327,86 @@ exitwait(void)
   printf(1, "exitwait ok\n");
 }
 
+// sleep() and usleep() wake at their deadline, from the timer
+// interrupt rather than a clock tick, and a killed sleeper
+// wakes at once.
+void
+sleeptest(void)
+{
+  int pid, t0, t;
+
+  printf(stdout, "sleep test\n");
+  t0 = uptime();
+  if(sleep(5) != 0 || (t = uptime() - t0) < 5 || t > 10){
+    printf(stdout, "sleep: sleep(5) took %d ticks\n", uptime() - t0);
+    exit();
+  }
+  t0 = uptime();
+  if(usleep(5*TICKUS) != 0 || (t = uptime() - t0) < 5 || t > 10){
+    printf(stdout, "sleep: usleep(%d) took %d ticks\n", 5*TICKUS, uptime() - t0);
+    exit();
+  }
+  if(usleep(-1) != -1){
+    printf(stdout, "sleep: usleep(-1) succeeded\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "sleep: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    usleep(1000000000);
+    exit();
+  }
+  usleep(TICKUS);
+  t0 = uptime();
+  kill(pid);
+  wait();
+  if(uptime() - t0 > 10){
+    printf(stdout, "sleep: killed sleeper took %d ticks\n", uptime() - t0);
+    exit();
+  }
+  printf(stdout, "sleep ok\n");
+}
+
+// printf() buffers its output, so a line longer than the
+// buffer, and numbers at the limits of their range, must
+// still reach the file whole and in order.
+void
+printftest(void)
+{
+  static char want[] = "-2147483648 0 -1 FFFFFFFF 7B %q x "
+    "0123456789012345678901234567890123456789012345678901234567890123456789"
+    "0123456789012345678901234567890123456789012345678901234567890123456789\n";
+  char *s;
+  int fd, n;
+
+  printf(stdout, "printf test\n");
+  s = want + sizeof("-2147483648 0 -1 FFFFFFFF 7B %q x ") - 1;
+  fd = open("printf.out", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "printf: create failed\n");
+    exit();
+  }
+  printf(fd, "%d %d %d %x %x %q %c %s", 0x80000000, 0, -1, -1, 123, 'x', s);
+  close(fd);
+  fd = open("printf.out", 0);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  unlink("printf.out");
+  if(n != sizeof(want) - 1){
+    printf(stdout, "printf: wrote %d bytes, not %d\n", n, sizeof(want) - 1);
+    exit();
+  }
+  buf[n] = 0;
+  if(strcmp(buf, want) != 0){
+    printf(stdout, "printf: wrong output\n");
+    exit();
+  }
+  printf(stdout, "printf ok\n");
+}
+
 void
 mem(void)
 {
@@ -1102,6 +1185,175 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// Sequential reads in odd sizes, which start readahead at
+// offsets within blocks, by two descriptors reading the same
+// file in turn, must each see the file's data.
+void
+readaheadtest(void)
+{
+  enum { N = 64*1024 };
+  static int size[2] = { 100, 300 };
+  int fd[2], off[2], i, j, n;
+
+  printf(1, "readahead test\n");
+  fd[0] = open("ra", O_CREATE|O_RDWR);
+  if(fd[0] < 0){
+    printf(1, "readahead: create failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i += 512){
+    for(j = 0; j < 512; j++)
+      buf[j] = (i + j) % 251;
+    if(write(fd[0], buf, 512) != 512){
+      printf(1, "readahead: write failed\n");
+      exit();
+    }
+  }
+  close(fd[0]);
+
+  fd[0] = open("ra", 0);
+  fd[1] = open("ra", 0);
+  off[0] = off[1] = 0;
+  while(off[0] < N || off[1] < N){
+    for(i = 0; i < 2; i++){
+      if(off[i] == N)
+        continue;
+      n = read(fd[i], buf, size[i]);
+      if(n <= 0){
+        printf(1, "readahead: read failed at %d\n", off[i]);
+        exit();
+      }
+      for(j = 0; j < n; j++){
+        if((uchar)buf[j] != (off[i] + j) % 251){
+          printf(1, "readahead: wrong data at %d\n", off[i] + j);
+          exit();
+        }
+      }
+      off[i] += n;
+    }
+  }
+  close(fd[0]);
+  close(fd[1]);
+  unlink("ra");
+  printf(1, "readahead ok\n");
+}
+
+// Two files grown a block at a time in turn must each read
+// back intact, and blocks freed by unlink and reused without
+// being zeroed must show nothing past the new file's end.
+void
+balloctest(void)
+{
+  int fd[2], i, j;
+
+  printf(1, "balloc test\n");
+  fd[0] = open("ba0", O_CREATE|O_RDWR);
+  fd[1] = open("ba1", O_CREATE|O_RDWR);
+  if(fd[0] < 0 || fd[1] < 0){
+    printf(1, "balloc: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++){
+    for(j = 0; j < 2; j++){
+      memset(buf, 'a' + j, 512);
+      ((int*)buf)[0] = i;
+      if(write(fd[j], buf, 512) != 512){
+        printf(1, "balloc: write failed\n");
+        exit();
+      }
+    }
+  }
+  close(fd[0]);
+  close(fd[1]);
+  for(j = 0; j < 2; j++){
+    fd[j] = open(j ? "ba1" : "ba0", 0);
+    for(i = 0; i < 100; i++){
+      if(read(fd[j], buf, 512) != 512 || ((int*)buf)[0] != i ||
+         buf[4] != 'a' + j || buf[511] != 'a' + j){
+        printf(1, "balloc: file %d block %d wrong\n", j, i);
+        exit();
+      }
+    }
+    close(fd[j]);
+  }
+  unlink("ba0");
+  unlink("ba1");
+
+  fd[0] = open("ba0", O_CREATE|O_RDWR);
+  if(write(fd[0], "xyz", 3) != 3){
+    printf(1, "balloc: write failed\n");
+    exit();
+  }
+  close(fd[0]);
+  fd[0] = open("ba0", 0);
+  if(read(fd[0], buf, 512) != 3 || read(fd[0], buf, 512) != 0){
+    printf(1, "balloc: read past end of file\n");
+    exit();
+  }
+  close(fd[0]);
+  unlink("ba0");
+  printf(1, "balloc ok\n");
+}
+
+// A file past the NDIRECT+NINDIRECT blocks the indirect
+// block can map, into the double-indirect block. The file
+// is written in blocks of BSIZE, and with large blocks is
+// cut to 5/8 of the FSSIZE-block disk, which is still past
+// the indirect block.
+void
+hugefile(void)
+{
+  int fd, i, j, n, cc;
+
+  printf(1, "hugefile test\n");
+
+  n = NDIRECT + NINDIRECT + 2*NINDIRECT + 1;
+  if(n > FSSIZE*5/8)
+    n = FSSIZE*5/8;
+  unlink("hugefile");
+  fd = open("hugefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create hugefile\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    memset(buf, i, BSIZE);
+    *(int*)buf = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(1, "write hugefile block %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("hugefile", 0);
+  if(fd < 0){
+    printf(1, "cannot open hugefile\n");
+    exit();
+  }
+  for(i = 0; i < n; i += cc / BSIZE){
+    cc = read(fd, buf, sizeof(buf));
+    if(cc <= 0 || cc % BSIZE != 0){
+      printf(1, "read hugefile failed at block %d\n", i);
+      exit();
+    }
+    for(j = 0; j < cc / BSIZE; j++){
+      if(*(int*)(buf + j*BSIZE) != i + j || buf[j*BSIZE + BSIZE-1] != (char)(i + j)){
+        printf(1, "read hugefile wrong data in block %d\n", i + j);
+        exit();
+      }
+    }
+  }
+  if(i != n || read(fd, buf, 1) != 0){
+    printf(1, "read hugefile wrong size\n");
+    exit();
+  }
+  close(fd);
+  unlink("hugefile");
+
+  printf(1, "hugefile test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1182,6 +1434,86 @@ rmdot(void)
   printf(1, "rmdot ok\n");
 }
 
+// The directory cache must follow creates, links and
+// unlinks, including of a directory whose inode is reused.
+void
+dcachetest(void)
+{
+  struct dcachestat st0, st1;
+  int fd, i;
+
+  printf(1, "dcache test\n");
+  if(mkdir("dc") != 0){
+    printf(1, "mkdir dc failed\n");
+    exit();
+  }
+  if(open("dc/x", 0) >= 0){
+    printf(1, "open dc/x before create worked!\n");
+    exit();
+  }
+  fd = open("dc/x", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create dc/x failed\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("dc/x", 0)) < 0){
+    printf(1, "open dc/x after create failed\n");
+    exit();
+  }
+  close(fd);
+  if(link("dc/x", "dc/y") != 0 || (fd = open("dc/y", 0)) < 0){
+    printf(1, "link dc/x dc/y failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dc/x") != 0 || unlink("dc/y") != 0){
+    printf(1, "unlink dc/x dc/y failed\n");
+    exit();
+  }
+  if(open("dc/x", 0) >= 0 || open("dc/y", 0) >= 0){
+    printf(1, "open dc/x after unlink worked!\n");
+    exit();
+  }
+
+  // A new dc may reuse the old one's inode.
+  if(unlink("dc") != 0 || mkdir("dc") != 0 || mkdir("dc/x") != 0){
+    printf(1, "recreate dc failed\n");
+    exit();
+  }
+  if(chdir("dc/x") != 0 || chdir("../..") != 0){
+    printf(1, "chdir dc/x/../.. failed\n");
+    exit();
+  }
+  if(open("dc/y", 0) >= 0){
+    printf(1, "open dc/y in new dc worked!\n");
+    exit();
+  }
+
+  if(kstat(KSTAT_DCACHE, &st0, sizeof(st0)) != sizeof(st0)){
+    printf(1, "kstat dcache failed\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++){
+    if((fd = open("dc/x", 0)) < 0){
+      printf(1, "open dc/x failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  kstat(KSTAT_DCACHE, &st1, sizeof(st1));
+  if(st1.hits - st0.hits < 10){
+    printf(1, "dcache: %d hits for 10 opens\n", st1.hits - st0.hits);
+    exit();
+  }
+
+  if(unlink("dc/x") != 0 || unlink("dc") != 0){
+    printf(1, "unlink dc failed\n");
+    exit();
+  }
+  printf(1, "dcache ok\n");
+}
+
 void
 dirfile(void)
 {
@@ -1275,6 +1607,51 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// An inode released by its last close stays cached,
+// so opening it again needs no disk read.
+void
+icachetest(void)
+{
+  struct icachestat st0, st1;
+  int fd, i;
+  char name[8];
+
+  printf(1, "icache test\n");
+  name[0] = 'i';
+  name[2] = '\0';
+  for(i = 0; i < 20; i++){
+    name[1] = 'a' + i;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "icache: create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  if(kstat(KSTAT_ICACHE, &st0, sizeof(st0)) != sizeof(st0)){
+    printf(1, "kstat icache failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    name[1] = 'a' + i;
+    if((fd = open(name, 0)) < 0){
+      printf(1, "icache: open %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  kstat(KSTAT_ICACHE, &st1, sizeof(st1));
+  if(st1.misses != st0.misses){
+    printf(1, "icache: %d misses reopening 20 files\n",
+           st1.misses - st0.misses);
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    name[1] = 'a' + i;
+    unlink(name);
+  }
+  printf(1, "icache ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1285,7 +1662,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<2000; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1293,8 +1670,8 @@ forktest(void)
       exit();
   }
   
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == 2000){
+    printf(1, "fork claimed to work 2000 times!\n");
     exit();
   }
   
@@ -1313,6 +1690,397 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// a process may lower its priority but not raise it
+// again, and a lowered process still runs once the
+// others sleep. bad levels are rejected.
+void
+priotest(void)
+{
+  int pid, fds[2];
+  char c;
+
+  printf(1, "prio test\n");
+  if(setprio(-1) == 0 || setprio(NPRIO) == 0){
+    printf(1, "setprio accepted a bad priority\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(setprio(NPRIO - 1) != 0){
+      printf(1, "setprio could not lower the priority\n");
+      exit();
+    }
+    if(setprio(0) == 0){
+      printf(1, "setprio raised the priority\n");
+      exit();
+    }
+    write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1){
+    printf(1, "low priority child never ran\n");
+    exit();
+  }
+  wait();
+  close(fds[0]);
+  printf(1, "prio test OK\n");
+}
+
+// bounce a byte between two processes through a pair of pipes;
+// every round trip costs two context switches.
+void
+ctxswbench(void)
+{
+  int ping[2], pong[2], pid, i, start, ticks;
+  char c;
+
+  printf(1, "ctxsw bench\n");
+  if(pipe(ping) != 0 || pipe(pong) != 0){
+    printf(1, "ctxsw bench: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "ctxsw bench: fork() failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      if(write(pong[1], &c, 1) != 1)
+        break;
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+  c = 'x';
+  start = uptime();
+  for(i = 0; i < 2000; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf(1, "ctxsw bench: lost the byte\n");
+      exit();
+    }
+  }
+  ticks = uptime() - start;
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+  printf(1, "ctxsw bench: %d switches in %d ticks\n", 2 * i, ticks);
+}
+
+// stream data through a pipe in page-aligned, page-sized
+// chunks, and report the throughput.
+void
+pipebench(void)
+{
+  enum { CHUNK = 4096, TOTAL = 4*1024*1024 };
+  int fds[2], pid, i, n, start, ticks;
+  char *oldbrk, *buf;
+
+  printf(1, "pipe bench\n");
+  oldbrk = sbrk(0);
+  buf = sbrk(2*CHUNK - (uint)oldbrk % CHUNK);
+  if(buf == (char*)-1){
+    printf(1, "pipe bench: sbrk failed\n");
+    exit();
+  }
+  buf += CHUNK - (uint)buf % CHUNK;
+  if(pipe(fds) != 0){
+    printf(1, "pipe bench: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "pipe bench: fork() failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < TOTAL; i += CHUNK){
+      buf[0] = i / CHUNK;
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf(1, "pipe bench: write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  start = uptime();
+  for(i = 0; i < TOTAL; i += n){
+    n = read(fds[0], buf, CHUNK);
+    if(n <= 0){
+      printf(1, "pipe bench: read failed\n");
+      exit();
+    }
+    if(i % CHUNK == 0 && n == CHUNK && buf[0] != (char)(i / CHUNK)){
+      printf(1, "pipe bench: wrong data\n");
+      exit();
+    }
+  }
+  ticks = uptime() - start;
+  close(fds[0]);
+  wait();
+  sbrk(-(sbrk(0) - oldbrk));
+  if(ticks == 0)
+    ticks = 1;
+  printf(1, "pipe bench: %d MB in %d ticks, %d MB/s\n",
+         TOTAL / (1024*1024), ticks, TOTAL / (1024*1024) * 100 / ticks);
+}
+
+// File write and read throughput, with writes of 512
+// bytes (as in writetest1) and of 4096 bytes (as in large
+// copies), at this build's block size, BSIZE.
+void
+fsbench(void)
+{
+  enum { TOTAL = 128*1024, ROUNDS = 4 };
+  static int chunks[] = { 512, 4096 };
+  int c, fd, i, r, n, start, wticks, rticks;
+
+  printf(1, "fs bench\n");
+  for(c = 0; c < 2; c++){
+    n = chunks[c];
+    wticks = rticks = 0;
+    for(r = 0; r < ROUNDS; r++){
+      start = uptime();
+      fd = open("fsbench", O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf(1, "fs bench: create failed\n");
+        exit();
+      }
+      for(i = 0; i < TOTAL; i += n){
+        ((int*)buf)[0] = i;
+        if(write(fd, buf, n) != n){
+          printf(1, "fs bench: write failed\n");
+          exit();
+        }
+      }
+      close(fd);
+      wticks += uptime() - start;
+
+      start = uptime();
+      fd = open("fsbench", O_RDONLY);
+      for(i = 0; i < TOTAL; i += n){
+        if(read(fd, buf, n) != n || ((int*)buf)[0] != i){
+          printf(1, "fs bench: read failed\n");
+          exit();
+        }
+      }
+      close(fd);
+      rticks += uptime() - start;
+      unlink("fsbench");
+    }
+    if(wticks == 0)
+      wticks = 1;
+    if(rticks == 0)
+      rticks = 1;
+    printf(1, "fs bench: bsize %d, %d-byte ops: write %d KB/s, read %d KB/s\n",
+           BSIZE, n, TOTAL / 1024 * ROUNDS * 100 / wticks,
+           TOTAL / 1024 * ROUNDS * 100 / rticks);
+  }
+}
+
+// fork shares memory copy-on-write: writes by the parent, by
+// the child, and by the kernel on the child's behalf (read()
+// into a shared page) must each land in a private copy.
+void
+cowtest(void)
+{
+  enum { N = 64*4096 };
+  char *p, *oldbrk;
+  int i, pid, fds[2], start, ticks;
+
+  printf(1, "cow test\n");
+  oldbrk = sbrk(0);
+  p = sbrk(N);
+  if(p == (char*)-1){
+    printf(1, "cow test: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i += 4096)
+    p[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "cow test: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i += 4096){
+      if(p[i] != 'p'){
+        printf(1, "cow test: child sees wrong data\n");
+        exit();
+      }
+      p[i] = 'c';
+    }
+    if(read(fds[0], p + 4096, 1) != 1 || p[4096] != 'k'){
+      printf(1, "cow test: read into shared page failed\n");
+      exit();
+    }
+    exit();
+  }
+  p[0] = 'P';
+  write(fds[1], "k", 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 4096; i < N; i += 4096){
+    if(p[i] != 'p'){
+      printf(1, "cow test: child's write reached the parent\n");
+      exit();
+    }
+  }
+
+  // fork+exit of a large parent should not copy its memory.
+  start = uptime();
+  for(i = 0; i < 100; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "cow test: fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  ticks = uptime() - start;
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(1, "cow test: 100 forks of a %d byte parent in %d ticks\n", N, ticks);
+  printf(1, "cow test OK\n");
+}
+
+// A running program's text is read from its file on demand,
+// so the file can't be opened for writing while it runs,
+// and a file open for writing can't be exec'd.
+void
+txtbusytest(void)
+{
+  char *argv[] = { "echo", "x", 0 };
+  char c;
+  int fd, pid, fds[2];
+
+  printf(1, "txtbusy test\n");
+  if((fd = open("usertests", O_RDWR)) >= 0){
+    printf(1, "txtbusy test: opened running usertests for writing\n");
+    exit();
+  }
+  if((fd = open("echo", O_WRONLY)) < 0){
+    printf(1, "txtbusy test: open echo failed\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "txtbusy test: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "txtbusy test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("echo", argv);
+    exit();
+  }
+  close(fds[1]);
+  wait();
+  if(read(fds[0], &c, 1) != 0){
+    printf(1, "txtbusy test: exec'd echo while open for writing\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fd);
+  printf(1, "txtbusy test OK\n");
+}
+
+// sbrk only reserves memory; pages are zero-filled on first
+// touch, including when the kernel is the first to touch one.
+void
+lazytest(void)
+{
+  enum { N = 32*1024*1024, MB = 1024*1024 };
+  char *p, *oldbrk, *hole;
+  int i, pid, fds[2], start, ticks;
+
+  printf(1, "lazy test\n");
+  oldbrk = sbrk(0);
+  start = uptime();
+  p = sbrk(N);
+  ticks = uptime() - start;
+  if(p == (char*)-1){
+    printf(1, "lazy test: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i += N/16){
+    if(p[i] != 0){
+      printf(1, "lazy test: untouched page not zero\n");
+      exit();
+    }
+    p[i] = 1;
+  }
+  if(pipe(fds) != 0){
+    printf(1, "lazy test: pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "k", 1);
+  if(read(fds[0], p + N - 1, 1) != 1 || p[N - 1] != 'k'){
+    printf(1, "lazy test: read into untouched page failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  pid = fork();
+  if(pid < 0){
+    printf(1, "lazy test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[N/2 + 4096] != 0 || p[N/2] != 1){
+      printf(1, "lazy test: child sees wrong data\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  sbrk(-(sbrk(0) - oldbrk));
+
+  // Shrinking to the middle of an untouched MB, which has no
+  // page table, must still free the pages of the next MB.
+  p = sbrk(3*MB);
+  if(p == (char*)-1){
+    printf(1, "lazy test: sbrk failed\n");
+    exit();
+  }
+  hole = (char*)(((uint)p + MB - 1) & ~(MB - 1));
+  hole[MB] = 1;
+  sbrk(hole + MB/2 - sbrk(0));
+  sbrk(p + 3*MB - sbrk(0));
+  if(hole[MB] != 0){
+    printf(1, "lazy test: page past a hole not freed\n");
+    exit();
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(1, "lazy test: sbrk(%d) took %d ticks\n", N, ticks);
+  printf(1, "lazy test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1644,12 +2412,16 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazytest();
+  txtbusytest();
   validatetest();
 
   opentest();
   writetest();
   writetest1();
   createtest();
+  printftest();
+  sleeptest();
 
   mem();
   pipe1();
@@ -1658,7 +2430,11 @@ main(int argc, char *argv[])
 
   rmdot();
   fourteen();
+  dcachetest();
   bigfile();
+  hugefile();
+  balloctest();
+  readaheadtest();
   subdir();
   concreate();
   linkunlink();
@@ -1669,7 +2445,13 @@ main(int argc, char *argv[])
   sharedfd();
   dirfile();
   iref();
+  icachetest();
   forktest();
+  cowtest();
+  priotest();
+  ctxswbench();
+  pipebench();
+  fsbench();
   bigdir(); // slow
 
   exectest();